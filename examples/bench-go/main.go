@@ -0,0 +1,639 @@
+// Command bench-go measures the cost of moving calls and data between Go and
+// the page. It runs headless in an offscreen window and prints the results
+// as JSON, so they can be stored and compared between releases:
+//
+//	go run ./examples/bench-go -n 1000 -o bench.json
+//
+// With -leak it instead opens and closes that many windows one after the
+// other and fails if the resident memory keeps growing after the warmup, by
+// more than -leak-max bytes per window.
+//
+// With -profiles it compares the default engine profile with
+// webui.LeanProfile: each one is started -runs times in a fresh process and
+// the median resident memory (UI, web and network processes) and time to
+// first paint are reported.
+//
+// Every result reports p50/p99/max latency in nanoseconds and the Go heap
+// allocations per operation. One way latencies (eval, invoke) compare the
+// page clock with the Go clock, both derived from the system wall clock, so
+// they are only as precise as performance.now() is in the engine.
+package main
+
+import (
+	"encoding/json"
+	"flag"
+	"fmt"
+	"io"
+	"log"
+	"math"
+	"net"
+	"net/http"
+	"os"
+	"os/exec"
+	"path/filepath"
+	"runtime"
+	"sort"
+	"strconv"
+	"strings"
+	"time"
+
+	"github.com/srfirouzi/webui"
+)
+
+const indexHTML = `<!doctype html>
+<html>
+	<head><meta http-equiv="X-UA-Compatible" content="IE=edge"></head>
+	<body>
+		<script type="text/javascript">
+			var origin = performance.timeOrigin || performance.timing.navigationStart;
+			var bench = {
+				rpcN: 0,
+				payloads: {},
+				// Wall clock time in ms, comparable with the Go clock
+				now: function() { return origin + performance.now(); },
+				ping: function() { window.external.invoke('t:' + bench.now()); },
+				recv: function(s) { window.external.invoke('n:' + s.length); },
+				send: function(n) {
+					if (!bench.payloads[n]) {
+						bench.payloads[n] = new Array(n + 1).join('x');
+					}
+					window.external.invoke(bench.payloads[n]);
+				}
+			};
+			// Methods are added by Bind(), render() chains the next call
+			var rpc = {
+				render: function(d) {
+					if (d.seq > 0 && d.seq < bench.rpcN) {
+						rpc.ping(d.seq + 1);
+					}
+				}
+			};
+		</script>
+	</body>
+</html>
+`
+
+// Result is a single benchmark measurement
+type Result struct {
+	Name        string  `json:"name"`
+	Payload     int     `json:"payload,omitempty"`
+	N           int     `json:"n"`
+	P50         int64   `json:"p50_ns"`
+	P99         int64   `json:"p99_ns"`
+	Max         int64   `json:"max_ns"`
+	Mean        int64   `json:"mean_ns"`
+	OpsPerSec   float64 `json:"ops_per_sec"`
+	AllocsPerOp float64 `json:"allocs_per_op"`
+	BytesPerOp  float64 `json:"bytes_per_op"`
+}
+
+// Report is the JSON document printed by the benchmark
+type Report struct {
+	Time    time.Time `json:"time"`
+	Go      string    `json:"go"`
+	OS      string    `json:"os"`
+	Arch    string    `json:"arch"`
+	Results []Result  `json:"results,omitempty"`
+	Leak    *Leak     `json:"leak,omitempty"`
+	// Medians of the runs of each engine profile, the default one first
+	Profiles []Profile `json:"profiles,omitempty"`
+}
+
+// Profile is the cost of starting a window with an engine profile
+type Profile struct {
+	Name string `json:"name"`
+	// Resident memory of this process and the engine processes it started
+	RSS int64 `json:"rss"`
+	// First paint of the page from its navigation start, 0 if the engine
+	// does not report paint timing
+	FirstPaint int64 `json:"first_paint_ns"`
+	// Startup phases from the window creation, see webui.StartupTimes
+	Committed int64 `json:"committed_ns"`
+	Ready     int64 `json:"ready_ns"`
+}
+
+// Leak is the resident memory while windows are opened and closed
+type Leak struct {
+	Windows int   `json:"windows"`
+	Start   int64 `json:"start_rss"`
+	Warm    int64 `json:"warm_rss"`
+	End     int64 `json:"end_rss"`
+	// Slope of the resident memory after the warmup, from a least squares
+	// fit of the samples
+	BytesPerWindow float64 `json:"bytes_per_window"`
+	Elapsed        int64   `json:"elapsed_ns"`
+}
+
+type bench struct {
+	w   webui.WebUI
+	got bool
+	msg string
+	at  time.Time
+	rpc *RPC
+}
+
+// RPC is bound to the page as `rpc`, each call is synced back to render()
+type RPC struct {
+	Seq   int `json:"seq"`
+	calls []time.Time
+}
+
+// Ping records the call, the following sync makes the page call it again
+func (r *RPC) Ping(seq int) {
+	r.Seq = seq
+	r.calls = append(r.calls, time.Now())
+}
+
+func startServer() string {
+	ln, err := net.Listen("tcp", "127.0.0.1:0")
+	if err != nil {
+		log.Fatal(err)
+	}
+	go func() {
+		defer ln.Close()
+		http.HandleFunc("/", func(w http.ResponseWriter, r *http.Request) {
+			w.Write([]byte(indexHTML))
+		})
+		log.Fatal(http.Serve(ln, nil))
+	}()
+	return "http://" + ln.Addr().String()
+}
+
+// waitFor runs the UI loop until cond is true
+func (b *bench) waitFor(cond func() bool) {
+	for !cond() {
+		if !b.w.Loop(true) {
+			log.Fatal("window closed")
+		}
+	}
+}
+
+// call evaluates js and waits for the page to answer with an invoke
+func (b *bench) call(js string) (sent time.Time, msg string) {
+	b.got = false
+	sent = time.Now()
+	b.w.Eval(js)
+	b.waitFor(func() bool { return b.got })
+	return sent, b.msg
+}
+
+// measure runs op warm times, then n times while counting allocations
+func measure(n, warm int, op func(record bool)) (allocs, bytes float64, elapsed time.Duration) {
+	for i := 0; i < warm; i++ {
+		op(false)
+	}
+	var before, after runtime.MemStats
+	runtime.GC()
+	runtime.ReadMemStats(&before)
+	start := time.Now()
+	for i := 0; i < n; i++ {
+		op(true)
+	}
+	elapsed = time.Since(start)
+	runtime.ReadMemStats(&after)
+	return float64(after.Mallocs-before.Mallocs) / float64(n),
+		float64(after.TotalAlloc-before.TotalAlloc) / float64(n), elapsed
+}
+
+func summarize(name string, payload int, d []time.Duration, allocs, bytes float64, elapsed time.Duration) Result {
+	r := Result{Name: name, Payload: payload, N: len(d), AllocsPerOp: allocs, BytesPerOp: bytes}
+	if len(d) == 0 {
+		return r
+	}
+	sort.Slice(d, func(i, j int) bool { return d[i] < d[j] })
+	rank := func(q float64) int64 {
+		return int64(d[int(math.Ceil(q*float64(len(d))))-1])
+	}
+	var sum time.Duration
+	for _, v := range d {
+		sum += v
+	}
+	r.P50, r.P99, r.Max = rank(0.50), rank(0.99), int64(d[len(d)-1])
+	r.Mean = int64(sum) / int64(len(d))
+	if elapsed > 0 {
+		r.OpsPerSec = float64(len(d)) / elapsed.Seconds()
+	}
+	return r
+}
+
+func msToTime(ms float64) time.Time {
+	return time.Unix(0, int64(ms*float64(time.Millisecond)))
+}
+
+// latency measures a native->JS eval answered by a JS->native invoke. The
+// page stamps the message, which splits the round trip into its two halves.
+func (b *bench) latency(n int) []Result {
+	var evals, invokes, trips []time.Duration
+	allocs, bytes, elapsed := measure(n, n/10, func(record bool) {
+		sent, msg := b.call(`bench.ping()`)
+		ms, err := strconv.ParseFloat(strings.TrimPrefix(msg, "t:"), 64)
+		if err != nil {
+			log.Fatal("unexpected message: ", msg)
+		}
+		if record {
+			stamp := msToTime(ms)
+			evals = append(evals, stamp.Sub(sent))
+			invokes = append(invokes, b.at.Sub(stamp))
+			trips = append(trips, b.at.Sub(sent))
+		}
+	})
+	return []Result{
+		summarize("eval", 0, evals, allocs, bytes, elapsed),
+		summarize("invoke", 0, invokes, allocs, bytes, elapsed),
+		summarize("eval_invoke_round_trip", 0, trips, allocs, bytes, elapsed),
+	}
+}
+
+// evalResult measures a synchronous EvalResult() round trip
+func (b *bench) evalResult(n int) Result {
+	var d []time.Duration
+	allocs, bytes, elapsed := measure(n, n/10, func(record bool) {
+		start := time.Now()
+		if _, err := b.w.EvalResult(`bench.rpcN`); err != nil {
+			log.Fatal(err)
+		}
+		if record {
+			d = append(d, time.Since(start))
+		}
+	})
+	return summarize("eval_result", 0, d, allocs, bytes, elapsed)
+}
+
+// bindRPC measures calls through a Bind() object: the page calls a method,
+// Go runs it and syncs the state back, and render() makes the next call.
+// The interval between two calls is a full RPC round trip.
+func (b *bench) bindRPC(n int) Result {
+	run := func(calls int) {
+		b.rpc.calls = b.rpc.calls[:0]
+		b.w.Eval(fmt.Sprintf(`bench.rpcN=%d;rpc.ping(1);`, calls))
+		b.waitFor(func() bool { return b.rpc.Seq == calls })
+	}
+	run(n/10 + 1)
+	allocs, bytes, elapsed := measure(1, 0, func(bool) { run(n + 1) })
+	d := make([]time.Duration, 0, n)
+	for i := 1; i < len(b.rpc.calls); i++ {
+		d = append(d, b.rpc.calls[i].Sub(b.rpc.calls[i-1]))
+	}
+	return summarize("bind_rpc", 0, d, allocs/float64(n), bytes/float64(n), elapsed)
+}
+
+// dispatch measures how fast functions queued by Dispatch() from another
+// goroutine run on the main thread, and how long each one waits
+func (b *bench) dispatch(n int) Result {
+	var d []time.Duration
+	run := func(record bool) {
+		done := 0
+		go func() {
+			for i := 0; i < n; i++ {
+				queued := time.Now()
+				b.w.Dispatch(func() {
+					if record {
+						d = append(d, time.Since(queued))
+					}
+					done++
+				})
+			}
+		}()
+		b.waitFor(func() bool { return done == n })
+	}
+	run(false)
+	allocs, bytes, elapsed := measure(1, 0, run)
+	return summarize("dispatch", 0, d, allocs/float64(n), bytes/float64(n), elapsed)
+}
+
+// batch measures a UI update of a title, a color and eight evals, made one
+// call at a time and as a single Batch
+func (b *bench) batch(n int) []Result {
+	const evals = 8
+	var single, batched []time.Duration
+	allocs, bytes, elapsed := measure(n, n/10, func(record bool) {
+		start := time.Now()
+		b.w.SetTitle("webui benchmark")
+		b.w.SetColor(255, 255, 255, 255)
+		for i := 0; i < evals; i++ {
+			b.w.Eval(`bench.rpcN=0`)
+		}
+		if record {
+			single = append(single, time.Since(start))
+		}
+	})
+	r := summarize("update_single_calls", 0, single, allocs, bytes, elapsed)
+	batch := b.w.NewBatch()
+	allocs, bytes, elapsed = measure(n, n/10, func(record bool) {
+		start := time.Now()
+		batch.SetTitle("webui benchmark").SetColor(255, 255, 255, 255)
+		for i := 0; i < evals; i++ {
+			batch.Eval(`bench.rpcN=0`)
+		}
+		batch.Run()
+		if record {
+			batched = append(batched, time.Since(start))
+		}
+	})
+	return []Result{r, summarize("update_batch", 0, batched, allocs, bytes, elapsed)}
+}
+
+// payload measures round trips carrying size bytes each way
+func (b *bench) payload(n, size int) []Result {
+	count := n * 1000 / size
+	if count > n {
+		count = n
+	} else if count < 5 {
+		count = 5
+	}
+	data := strings.Repeat("x", size)
+	var evals, invokes []time.Duration
+	allocs, bytes, elapsed := measure(count, 1, func(record bool) {
+		sent, msg := b.call(`bench.recv("` + data + `")`)
+		if msg != "n:"+strconv.Itoa(size) {
+			log.Fatal("unexpected message: ", msg)
+		}
+		if record {
+			evals = append(evals, b.at.Sub(sent))
+		}
+	})
+	eval := summarize("payload_eval", size, evals, allocs, bytes, elapsed)
+	allocs, bytes, elapsed = measure(count, 1, func(record bool) {
+		sent, msg := b.call(`bench.send(` + strconv.Itoa(size) + `)`)
+		if len(msg) != size {
+			log.Fatal("unexpected payload size: ", len(msg))
+		}
+		if record {
+			invokes = append(invokes, b.at.Sub(sent))
+		}
+	})
+	invoke := summarize("payload_invoke", size, invokes, allocs, bytes, elapsed)
+	return []Result{eval, invoke}
+}
+
+// rss returns the resident memory of the process in bytes (Linux only)
+func rss() int64 {
+	b, err := os.ReadFile("/proc/self/statm")
+	if err != nil {
+		return 0
+	}
+	f := strings.Fields(string(b))
+	if len(f) < 2 {
+		return 0
+	}
+	pages, _ := strconv.ParseInt(f[1], 10, 64)
+	return pages * int64(os.Getpagesize())
+}
+
+// treeRSS returns the resident memory of the process and all of its
+// descendants in bytes (Linux only), which includes the web processes
+func treeRSS() int64 {
+	children := map[int][]int{}
+	stats, _ := filepath.Glob("/proc/[0-9]*/stat")
+	for _, path := range stats {
+		b, err := os.ReadFile(path)
+		if err != nil {
+			continue
+		}
+		// pid (comm) state ppid ..., comm may contain spaces
+		i := strings.LastIndexByte(string(b), ')')
+		if i < 0 {
+			continue
+		}
+		f := strings.Fields(string(b[i+1:]))
+		if len(f) < 2 {
+			continue
+		}
+		pid, err1 := strconv.Atoi(filepath.Base(filepath.Dir(path)))
+		ppid, err2 := strconv.Atoi(f[1])
+		if err1 == nil && err2 == nil {
+			children[ppid] = append(children[ppid], pid)
+		}
+	}
+	var total int64
+	pids := []int{os.Getpid()}
+	for len(pids) > 0 {
+		pid := pids[0]
+		pids = append(pids[1:], children[pid]...)
+		b, err := os.ReadFile(fmt.Sprintf("/proc/%d/statm", pid))
+		if err != nil {
+			continue
+		}
+		if f := strings.Fields(string(b)); len(f) > 1 {
+			pages, _ := strconv.ParseInt(f[1], 10, 64)
+			total += pages * int64(os.Getpagesize())
+		}
+	}
+	return total
+}
+
+// profile starts one window with the named engine profile and measures it
+func profile(name string) Profile {
+	var features webui.Feature
+	if name == "lean" {
+		features = webui.LeanProfile
+	}
+	w := webui.New(webui.Settings{
+		Title:            "webui profile",
+		HTML:             indexHTML,
+		Offscreen:        true,
+		DisabledFeatures: features,
+	})
+	defer w.Exit()
+	if err := w.WaitReady(30 * time.Second); err != nil {
+		log.Fatal(err)
+	}
+	// Let the engine processes settle before reading their memory
+	for end := time.Now().Add(time.Second); time.Now().Before(end); {
+		w.Loop(false)
+		time.Sleep(time.Millisecond)
+	}
+	p := Profile{Name: name, RSS: treeRSS()}
+	paint, err := w.EvalResult(`(function(){var p=window.performance,` +
+		`e=p&&p.getEntriesByType?p.getEntriesByType('paint'):[];` +
+		`return e.length?e[0].startTime:0;})()`)
+	if err == nil {
+		ms, _ := strconv.ParseFloat(paint, 64)
+		p.FirstPaint = int64(ms * float64(time.Millisecond))
+	}
+	t := w.StartupTimes()
+	p.Committed, p.Ready = int64(t.Committed), int64(t.Ready)
+	return p
+}
+
+// profiles runs every profile in its own process, the engine is set up
+// once per process, and returns the medians
+func profiles(runs int) []Profile {
+	var result []Profile
+	for _, name := range []string{"default", "lean"} {
+		var all []Profile
+		for i := 0; i < runs; i++ {
+			out, err := exec.Command(os.Args[0], "-profile", name).Output()
+			if err != nil {
+				log.Fatal(err)
+			}
+			var r Report
+			if err := json.Unmarshal(out, &r); err != nil || len(r.Profiles) != 1 {
+				log.Fatal("bad profile report: ", err)
+			}
+			all = append(all, r.Profiles[0])
+		}
+		median := func(v func(p Profile) int64) int64 {
+			sort.Slice(all, func(i, j int) bool { return v(all[i]) < v(all[j]) })
+			return v(all[len(all)/2])
+		}
+		result = append(result, Profile{
+			Name:       name,
+			RSS:        median(func(p Profile) int64 { return p.RSS }),
+			FirstPaint: median(func(p Profile) int64 { return p.FirstPaint }),
+			Committed:  median(func(p Profile) int64 { return p.Committed }),
+			Ready:      median(func(p Profile) int64 { return p.Ready }),
+		})
+	}
+	return result
+}
+
+// slope fits a line through the samples and returns its slope
+func slope(x, y []float64) float64 {
+	var sx, sy, sxx, sxy float64
+	for i := range x {
+		sx += x[i]
+		sy += y[i]
+		sxx += x[i] * x[i]
+		sxy += x[i] * y[i]
+	}
+	k := float64(len(x))
+	d := k*sxx - sx*sx
+	if d == 0 {
+		return 0
+	}
+	return (k*sxy - sx*sy) / d
+}
+
+// leak opens and closes n windows, each loading a page, evaluating a script
+// and running a dispatched function. The first tenth warms up the allocator
+// and caches, the resident memory over the rest should be flat.
+func leak(n int) *Leak {
+	open := func() {
+		invoked := false
+		w := webui.New(webui.Settings{
+			Title:     "webui leak check",
+			HTML:      indexHTML,
+			Offscreen: true,
+			ExternalInvokeCallback: func(w webui.WebUI, data string) {
+				invoked = true
+			},
+		})
+		if err := w.WaitReady(30 * time.Second); err != nil {
+			log.Fatal(err)
+		}
+		dispatched := false
+		w.Dispatch(func() { dispatched = true })
+		w.Eval(`bench.ping()`)
+		for !invoked || !dispatched {
+			if !w.Loop(true) {
+				log.Fatal("window closed")
+			}
+		}
+		// Queued work and callbacks must go away with the window
+		w.Dispatch(func() { log.Fatal("dispatched after Exit()") })
+		w.Exit()
+	}
+	l := &Leak{Windows: n, Start: rss()}
+	warm := n / 10
+	every := (n - warm) / 100
+	if every < 1 {
+		every = 1
+	}
+	var x, y []float64
+	start := time.Now()
+	for i := 0; i < n; i++ {
+		if i >= warm && (i-warm)%every == 0 {
+			runtime.GC()
+			r := rss()
+			if i == warm {
+				l.Warm = r
+			}
+			x, y = append(x, float64(i)), append(y, float64(r))
+		}
+		open()
+	}
+	runtime.GC()
+	l.End = rss()
+	l.Elapsed = int64(time.Since(start))
+	x, y = append(x, float64(n)), append(y, float64(l.End))
+	l.BytesPerWindow = slope(x, y)
+	return l
+}
+
+func main() {
+	n := flag.Int("n", 1000, "iterations per latency benchmark")
+	maxPayload := flag.Int("max-payload", 10*1000*1000, "largest payload in bytes")
+	out := flag.String("o", "", "write the JSON report to this file instead of stdout")
+	leakN := flag.Int("leak", 0, "open and close this many windows and check the memory instead")
+	leakMax := flag.Float64("leak-max", 256, "bytes of resident memory per window that -leak tolerates")
+	compare := flag.Bool("profiles", false, "compare the default and the lean engine profile instead")
+	runs := flag.Int("runs", 5, "processes started per profile with -profiles")
+	one := flag.String("profile", "", "measure a single profile, default or lean (used by -profiles)")
+	flag.Parse()
+
+	report := Report{Time: time.Now(), Go: runtime.Version(), OS: runtime.GOOS, Arch: runtime.GOARCH}
+	if *one != "" || *compare {
+		if *one != "" {
+			report.Profiles = []Profile{profile(*one)}
+		} else {
+			report.Profiles = profiles(*runs)
+		}
+		writeReport(report, *out)
+		return
+	}
+	if *leakN > 0 {
+		report.Leak = leak(*leakN)
+		writeReport(report, *out)
+		// Allocator caches settle within the warmup, steady growth is a leak
+		if report.Leak.BytesPerWindow > *leakMax {
+			log.Fatalf("resident memory grew by %.0f bytes per window", report.Leak.BytesPerWindow)
+		}
+		return
+	}
+
+	b := &bench{rpc: &RPC{}}
+	b.w = webui.New(webui.Settings{
+		Title:     "webui benchmark",
+		URL:       startServer(),
+		Offscreen: true,
+		ExternalInvokeCallback: func(w webui.WebUI, data string) {
+			b.got, b.msg, b.at = true, data, time.Now()
+		},
+	})
+	defer b.w.Exit()
+	if err := b.w.WaitReady(30 * time.Second); err != nil {
+		log.Fatal(err)
+	}
+	if _, err := b.w.Bind("rpc", b.rpc); err != nil {
+		log.Fatal(err)
+	}
+
+	report.Results = append(report.Results, b.latency(*n)...)
+	report.Results = append(report.Results, b.evalResult(*n))
+	report.Results = append(report.Results, b.bindRPC(*n))
+	report.Results = append(report.Results, b.dispatch(*n))
+	report.Results = append(report.Results, b.batch(*n)...)
+	for size := 10; size <= *maxPayload; size *= 10 {
+		report.Results = append(report.Results, b.payload(*n, size)...)
+	}
+	writeReport(report, *out)
+}
+
+// writeReport prints the report as JSON to stdout or the out file
+func writeReport(report Report, out string) {
+	var w io.Writer = os.Stdout
+	if out != "" {
+		f, err := os.Create(out)
+		if err != nil {
+			log.Fatal(err)
+		}
+		defer f.Close()
+		w = f
+	}
+	enc := json.NewEncoder(w)
+	enc.SetIndent("", "  ")
+	if err := enc.Encode(report); err != nil {
+		log.Fatal(err)
+	}
+}
@@ -28,9 +28,8 @@ var indexHTML = fmt.Sprintf(`
 			Your browser doesn't support HTML5 canvas element.
 		</canvas>
 		<script type="text/javascript">
-			window.drawData = {};
-			function draw() {
-				window.external.invoke('draw');
+			// Called by the native side once per frame with the frame's state
+			function draw(drawData) {
 				var canvas = document.getElementById('canvas');
 				var ctx = canvas.getContext('2d');
 				ctx.clearRect(0, 0, canvas.width, canvas.height);
@@ -38,9 +37,7 @@ var indexHTML = fmt.Sprintf(`
 				ctx.moveTo(drawData.x1, drawData.y1);
 				ctx.lineTo(drawData.x2, drawData.y2);
 				ctx.stroke();
-				window.requestAnimationFrame(draw);
 			}
-			draw();
 		</script>
 	</body>
 </html>
@@ -63,35 +60,36 @@ func startServer() string {
 
 var (
 	numFrames int
-	prevTime  time.Time
+	prevTime  time.Duration
 	totalTime time.Duration
 )
 
-func handleRPC(w webui.WebUI, data string) {
+func onFrame(w webui.WebUI, frameTime time.Duration, frame int64) {
 	numFrames++
-	if !prevTime.IsZero() {
-		totalTime = totalTime + time.Since(prevTime)
+	if prevTime != 0 {
+		totalTime = totalTime + frameTime - prevTime
 	}
-	prevTime = time.Now()
+	prevTime = frameTime
 	if numFrames%100 == 0 {
 		d := totalTime / time.Duration(numFrames)
 		log.Println("time per frame:", d, " fps:", int(time.Second/d))
 	}
-	s := fmt.Sprintf(`drawData = {x1:%d,y1:%d,x2:%d,y2:%d}`,
+	s := fmt.Sprintf(`draw({x1:%d,y1:%d,x2:%d,y2:%d})`,
 		rand.Intn(windowWidth), rand.Intn(windowHeight),
 		rand.Intn(windowWidth), rand.Intn(windowHeight))
-	w.Eval(s)
+	// Eval() would wait for the page inside the frame clock
+	w.EvalAsync(s)
 }
 
 func main() {
 	url := startServer()
 	w := webui.New(webui.Settings{
-		Width:                  windowWidth,
-		Height:                 windowHeight,
-		Title:                  "Simple canvas demo",
-		URL:                    url,
-		ExternalInvokeCallback: handleRPC,
+		Width:  windowWidth,
+		Height: windowHeight,
+		Title:  "Simple canvas demo",
+		URL:    url,
 	})
 	defer w.Exit()
+	w.OnFrame(onFrame)
 	w.Run()
 }
@@ -10,9 +10,14 @@ import (
 
 var uiFrameworkName = "Picodom"
 
+func init() {
+	// Register Picodom.js once, all windows share it
+	webui.RegisterLibrary("picodom", string(MustAsset("js/picodom/vendor/picodom.js")))
+}
+
 func loadUIFramework(w webui.WebUI) {
 	// Inject Picodom.js
-	w.Eval(string(MustAsset("js/picodom/vendor/picodom.js")))
+	w.UseLibrary("picodom")
 	// Inject app code
 	w.Eval(string(MustAsset("js/picodom/app.js")))
 }
@@ -13,10 +13,16 @@ import (
 
 var uiFrameworkName = "ReactJS+Babel"
 
+func init() {
+	// Register Babel and Preact once, all windows share them
+	webui.RegisterLibrary("babel", string(MustAsset("js/react/vendor/babel.min.js")))
+	webui.RegisterLibrary("preact", string(MustAsset("js/react/vendor/preact.min.js")))
+}
+
 func loadUIFramework(w webui.WebUI) {
 	// Inject React and Babel
-	w.Eval(string(MustAsset("js/react/vendor/babel.min.js")))
-	w.Eval(string(MustAsset("js/react/vendor/preact.min.js")))
+	w.UseLibrary("babel")
+	w.UseLibrary("preact")
 
 	// Inject our app code
 	w.Eval(fmt.Sprintf(`(function(){
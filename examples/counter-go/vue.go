@@ -10,9 +10,14 @@ import (
 
 var uiFrameworkName = "VueJS"
 
+func init() {
+	// Register Vue.js once, all windows share it
+	webui.RegisterLibrary("vue", string(MustAsset("js/vue/vendor/vue.min.js")))
+}
+
 func loadUIFramework(w webui.WebUI) {
 	// Inject Vue.js
-	w.Eval(string(MustAsset("js/vue/vendor/vue.min.js")))
+	w.UseLibrary("vue")
 	// Inject app code
 	w.Eval(string(MustAsset("js/vue/app.js")))
 }
@@ -0,0 +1,152 @@
+/*
+ * Checks lib/jsencode.h against the previous byte by byte encoder on random
+ * input and measures both:
+ *
+ *   make && ./jsencode [iterations]
+ *
+ * Build with CFLAGS_ARCH=-mavx2 to measure the AVX2 path.
+ */
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <lib/jsencode.h>
+
+/* The encoder lib/gtk.h and lib/win.h used before */
+static int ref_js_encode(const char *s, char *esc, size_t n) {
+  int r = 1; /* At least one byte for trailing zero */
+  for (; *s; s++) {
+    const unsigned char c = *s;
+    if (c >= 0x20 && c < 0x80 && strchr("<>\\'\"", c) == NULL) {
+      if (n > 0) {
+        *esc++ = c;
+        n--;
+      }
+      r++;
+    } else {
+      if (n > 0) {
+        snprintf(esc, n, "\\x%02x", (int)c);
+        esc += 4;
+        n -= 4;
+      }
+      r += 4;
+    }
+  }
+  return r;
+}
+
+static uint32_t seed = 2463534242u;
+
+static uint32_t next(void) {
+  seed ^= seed << 13;
+  seed ^= seed >> 17;
+  seed ^= seed << 5;
+  return seed;
+}
+
+/* Fills s with len non-zero bytes, unsafe ones one in every `every` */
+static void fill(char *s, size_t len, uint32_t every) {
+  static const char text[] = "body { color: #fff; margin: 0 auto; } abcXYZ019";
+  for (size_t i = 0; i < len; i++) {
+    if (every > 0 && next() % every == 0) {
+      s[i] = (char)(next() % 255 + 1);
+    } else {
+      s[i] = text[next() % (sizeof(text) - 1)];
+    }
+  }
+  s[len] = '\0';
+}
+
+static int check(int iterations) {
+  char in[1024], want[4096], got[4096];
+  for (int i = 0; i < iterations; i++) {
+    size_t off = next() % 32;
+    size_t len = next() % (sizeof(in) - off - 1);
+    uint32_t every = next() % 4 == 0 ? 1 : next() % 64;
+    fill(in + off, len, every);
+    const char *s = in + off;
+
+    int n = ref_js_encode(s, NULL, 0);
+    ref_js_encode(s, want, n);
+    want[n - 1] = '\0';
+    if (webui_js_encode(s, NULL, 0) != n) {
+      fprintf(stderr, "size mismatch for input %d: %d, want %d\n", i,
+              webui_js_encode(s, NULL, 0), n);
+      return 1;
+    }
+    memset(got, 0x55, sizeof(got));
+    webui_js_encode(s, got, n);
+    struct webui_buf b = {NULL, 0, 0};
+    webui_buf_append_str(&b, "(\"");
+    webui_buf_append_js(&b, s, len);
+    if (strcmp(got, want) != 0 || strncmp(b.data + 2, want, n) != 0 ||
+        b.len != (size_t)n + 1) {
+      fprintf(stderr, "output mismatch for input %d:\n%s\nwant:\n%s\n", i,
+              got, want);
+      free(b.data);
+      return 1;
+    }
+    free(b.data);
+  }
+  printf("%d random inputs encode the same as before\n", iterations);
+  return 0;
+}
+
+static double mbps(size_t bytes, clock_t start, int rounds) {
+  double sec = (double)(clock() - start) / CLOCKS_PER_SEC;
+  return sec > 0 ? (double)bytes * rounds / sec / 1e6 : 0;
+}
+
+static void bench(const char *name, uint32_t every) {
+  const size_t len = 4 * 1000 * 1000;
+  const int rounds = 20;
+  char *in = (char *)malloc(len + 1);
+  char *out = (char *)malloc(len * 4 + 1);
+  fill(in, len, every);
+
+  /* both size the output first, then encode */
+  clock_t start = clock();
+  for (int i = 0; i < rounds; i++) {
+    int n = ref_js_encode(in, NULL, 0);
+    ref_js_encode(in, out, n);
+  }
+  double before = mbps(len, start, rounds);
+  start = clock();
+  for (int i = 0; i < rounds; i++) {
+    int n = webui_js_encode(in, NULL, 0);
+    webui_js_encode(in, out, n);
+  }
+  double after = mbps(len, start, rounds);
+  /* a single pass into a growing buffer */
+  start = clock();
+  for (int i = 0; i < rounds; i++) {
+    struct webui_buf b = {NULL, 0, 0};
+    webui_buf_append_js(&b, in, len);
+    free(b.data);
+  }
+  double buf = mbps(len, start, rounds);
+  printf("%-8s before %8.1f MB/s  after %8.1f MB/s  one pass %8.1f MB/s\n",
+         name, before, after, buf);
+  free(in);
+  free(out);
+}
+
+int main(int argc, char *argv[]) {
+  int iterations = argc > 1 ? atoi(argv[1]) : 100000;
+  if (check(iterations) != 0) {
+    return 1;
+  }
+#if defined(WEBUI_JS_AVX2)
+  printf("AVX2 and SSE2\n");
+#elif defined(WEBUI_JS_SSE2)
+  printf("SSE2\n");
+#else
+  printf("scalar\n");
+#endif
+  bench("css", 0);
+  bench("json", 16);
+  bench("binary", 1);
+  return 0;
+}
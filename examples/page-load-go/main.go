@@ -24,6 +24,18 @@ var indexHTML = `
 </html>
 `
 
+// logLoad prints how long each step of the page load took
+func logLoad(w webui.WebUI, e webui.LoadEvent) {
+	switch e.Type {
+	case webui.LoadFailed:
+		log.Println("load failed at", e.Time, e.URI, e.Error)
+	case webui.LoadTiming:
+		log.Println("page timing:", string(e.Timing))
+	default:
+		log.Println("load event", e.Type, "at", e.Time, e.URI)
+	}
+}
+
 func runLocalHTTP() {
 	ln, err := net.Listen("tcp", "127.0.0.1:0")
 	if err != nil {
@@ -38,8 +50,9 @@ func runLocalHTTP() {
 	}()
 	url := "http://" + ln.Addr().String()
 	w := webui.New(webui.Settings{
-		Title: "Loaded: Local HTTP Server",
-		URL:   url,
+		Title:        "Loaded: Local HTTP Server",
+		URL:          url,
+		LoadCallback: logLoad,
 	})
 	defer w.Exit()
 	w.Run()
@@ -77,6 +90,15 @@ func runDataURL() {
 	w.Run()
 }
 
+func runInlineHTML() {
+	w := webui.New(webui.Settings{
+		Title: "Loaded: Inline HTML",
+		HTML:  indexHTML,
+	})
+	defer w.Exit()
+	w.Run()
+}
+
 func runInjectJS() {
 	w := webui.New(webui.Settings{
 		Title: "Loaded: Injected via JavaScript",
@@ -93,5 +115,6 @@ func main() {
 	runLocalHTTP()
 	//runLocalFile()
 	//runDataURL()
+	//runInlineHTML()
 	//runInjectJS()
 }
@@ -0,0 +1,70 @@
+/*
+ * The batch executor shared by lib/gtk.h and lib/win.h. It only calls the
+ * public API, so each header includes it once the prototypes are declared.
+ */
+#ifndef WEBUI_BATCH_H
+#define WEBUI_BATCH_H
+
+#include <stdint.h>
+
+/*
+ * A batch is a sequence of commands, each a little endian uint32 op, uint32
+ * arg and uint32 length followed by that many bytes of string data without
+ * a trailing zero. The whole buffer is checked before anything runs, then
+ * the commands run in order and each one's status goes into results.
+ * Returns the number of commands or -1 for a malformed buffer.
+ */
+static uint32_t webui_batch_u32(const unsigned char *p) {
+  return (uint32_t)p[0] | (uint32_t)p[1] << 8 | (uint32_t)p[2] << 16 |
+         (uint32_t)p[3] << 24;
+}
+
+WEBUI_API int webui_batch_exec(struct webui *w, const char *buf, size_t len,
+                               int *results, int nresults) {
+  const unsigned char *start = (const unsigned char *)buf;
+  const unsigned char *end = start + len;
+  const unsigned char *p;
+  for (p = start; p != end; p += 12 + webui_batch_u32(p + 8)) {
+    if (end - p < 12 || (size_t)(end - p - 12) < webui_batch_u32(p + 8)) {
+      return -1;
+    }
+  }
+  int n = 0;
+  for (p = start; p != end; n++) {
+    uint32_t op = webui_batch_u32(p), arg = webui_batch_u32(p + 4);
+    size_t size = webui_batch_u32(p + 8);
+    const char *s = (const char *)p + 12;
+    p += 12 + size;
+    int r = 0;
+    switch (op) {
+    case WEBUI_BATCH_EVAL:
+      r = webui_eval_n(w, s, size);
+      break;
+    case WEBUI_BATCH_INJECT_CSS:
+      r = webui_inject_css_n(w, s, size);
+      break;
+    case WEBUI_BATCH_SET_TITLE:
+      webui_set_title_n(w, s, size);
+      break;
+    case WEBUI_BATCH_SET_COLOR:
+      webui_set_color(w, arg >> 24, (arg >> 16) & 0xff, (arg >> 8) & 0xff,
+                      arg & 0xff);
+      break;
+    case WEBUI_BATCH_SET_FULLSCREEN:
+      webui_set_fullscreen(w, arg != 0);
+      break;
+    case WEBUI_BATCH_STYLE_REPLACE:
+      r = webui_style_replace_n(w, (int)arg, s, size);
+      break;
+    default:
+      r = -1;
+      break;
+    }
+    if (n < nresults) {
+      results[n] = r;
+    }
+  }
+  return n;
+}
+
+#endif /* WEBUI_BATCH_H */
@@ -1,26 +1,129 @@
 #include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/resource.h>
 
 #include <JavaScriptCore/JavaScript.h>
+#include <glib/gstdio.h>
 #include <gtk/gtk.h>
 #include <webkit2/webkit2.h>
 
+#include "jsencode.h"
+
 #ifdef WEBUI_STATIC
 #define WEBUI_API static
 #else
 #define WEBUI_API extern
 #endif
 
+#ifndef WEBUI_SCREEN_CACHE
+#define WEBUI_SCREEN_CACHE 4
+#endif
+
+struct webui_screen {
+  char *url;
+  GtkWidget *view;
+  unsigned int used;
+  int committed; /* the view shows the document of its current load */
+};
+
+/* startup phase timestamps in microseconds of the monotonic clock, 0 when
+ * the phase has not been reached yet */
+struct webui_startup {
+  int64_t init;
+  int64_t committed;
+  int64_t finished;
+  int64_t ready;
+  int64_t shown;
+};
+
+/* Latency histograms in microseconds are log-linear like HdrHistogram:
+ * below 8us every value has its own bucket, above each power of two is split
+ * into 8 linear sub-buckets, so a bucket is at most 12.5% wide. The last
+ * bucket also holds everything from 2^31us on. */
+#define WEBUI_HISTOGRAM_SUB_BITS 3
+#define WEBUI_HISTOGRAM_BUCKETS 232
+
+/* cumulative counters of a window, see webui_get_stats() */
+struct webui_stats {
+  uint64_t evals;
+  uint64_t invokes;
+  uint64_t dispatches;
+  uint64_t bytes_to_page;   /* JS code sent with eval */
+  uint64_t bytes_from_page; /* invoke messages */
+  int queue_depth;          /* dispatched functions waiting to run */
+  int evals_in_flight;
+  uint64_t eval_latency[WEBUI_HISTOGRAM_BUCKETS];
+  uint64_t invoke_latency[WEBUI_HISTOGRAM_BUCKETS];   /* in the callback */
+  uint64_t dispatch_latency[WEBUI_HISTOGRAM_BUCKETS]; /* queued to run */
+  /* with input_latency set: presses and scrolls, the time until the page
+   * painted the frame after them and to the first invoke they trigger */
+  uint64_t inputs;
+  uint64_t input_paint_latency[WEBUI_HISTOGRAM_BUCKETS];
+  uint64_t input_handler_latency[WEBUI_HISTOGRAM_BUCKETS];
+  /* time spent visible and hidden and the CPU time this process used in
+   * each, in microseconds; evals deferred while hidden with throttle_hidden */
+  int64_t visible_time;
+  int64_t hidden_time;
+  int64_t cpu_visible;
+  int64_t cpu_hidden;
+  uint64_t deferred_evals;
+  uint64_t eval_timeouts; /* evals given up on after their timeout */
+  uint64_t eval_cancels;  /* and with webui_eval_cancel() */
+};
+
+/* zeroed by the caller, webui_eval_cancel() stops the webui_eval_timeout()
+ * calls it was passed to */
+struct webui_cancel {
+  int cancelled;
+};
+
+struct webui;
+
+typedef void (*webui_frame_cb)(struct webui *w, int64_t frame_time,
+                               int64_t frame_counter);
+
 struct webui_priv {
   GtkWidget *window;
   GtkWidget *scroller;
   GtkWidget *webui;
   GtkWidget *inspector_window;
+  WebKitUserContentManager *content;
+  struct webui_screen screens[WEBUI_SCREEN_CACHE];
+  unsigned int screen_clock;
   GAsyncQueue *queue;
   int ready;
-  int js_busy;
   int should_exit;
+  struct webui_startup startup;
+  guint show_timer;
+  webui_frame_cb frame_cb;
+  guint frame_tick;
+  int id;
+  int64_t load_started;
+  struct webui_stats stats;
+  int64_t input_paint_pending;
+  int64_t input_handler_pending;
+  int mapped;
+  int iconified;
+  int visible;
+  int focused;
+  int focused_reported;
+  int64_t visible_since;
+  int64_t cpu_since;
+  /* visible, visible_since, cpu_since and the visible/hidden totals change
+   * together, webui_get_stats() reads them from any thread */
+  GMutex visibility_lock;
+  GQueue *deferred;
+  unsigned int generation; /* bumped when the web process goes away */
+  int recovering;          /* reason + 1 while reloading after that */
+  int hang_killed;
+  guint hang_timer;
+  int committed;
+  GHashTable *libraries; /* names of the libraries in use */
+  GHashTable *styles;    /* style sheets by id */
+  struct webui_buf script; /* terminates _n strings for WebKit */
+  int styles_next;
+  int destroyed; /* the window was closed, its widgets are gone */
 };
 
 struct webui;
@@ -28,6 +131,15 @@ struct webui;
 typedef void (*webui_external_invoke_cb_t)(struct webui *w,
                                              const char *arg);
 typedef int (*webui_close_cb)(struct webui *w);
+/* ts is microseconds of the monotonic clock, data is the error message of
+ * WEBUI_LOAD_FAILED and the JSON timing entries of WEBUI_LOAD_TIMING */
+typedef void (*webui_load_cb)(struct webui *w, int event, int64_t ts,
+                              const char *uri, const char *data);
+/* visible is 0 while the window is minimized or unmapped */
+typedef void (*webui_visibility_cb)(struct webui *w, int visible, int focused);
+/* called once the page has been reloaded in a new web process, the page
+ * state and anything injected with webui_eval() are gone */
+typedef void (*webui_recover_cb)(struct webui *w, int reason);
 
 enum webui_border_type{
   WEBUI_BORDER_NONE=2,
@@ -35,6 +147,76 @@ enum webui_border_type{
   WEBUI_BORDER_RESIZABLE=0
 };
 
+enum webui_cache_model{
+  WEBUI_CACHE_DEFAULT=0,
+  WEBUI_CACHE_DOCUMENT_VIEWER=1,
+  WEBUI_CACHE_DOCUMENT_BROWSER=2,
+  WEBUI_CACHE_WEB_BROWSER=3
+};
+
+enum webui_process_model{
+  WEBUI_PROCESS_DEFAULT=0,
+  WEBUI_PROCESS_SHARED=1,
+  WEBUI_PROCESS_PER_VIEW=2
+};
+
+enum webui_feature{
+  WEBUI_FEATURE_PLUGINS=1 << 0,
+  WEBUI_FEATURE_SPELL_CHECKING=1 << 1, /* process-wide, like FAVICONS */
+  WEBUI_FEATURE_PAGE_CACHE=1 << 2,
+  WEBUI_FEATURE_SMOOTH_SCROLLING=1 << 3,
+  WEBUI_FEATURE_WEBGL=1 << 4,
+  WEBUI_FEATURE_MEDIA_SOURCE=1 << 5,
+  WEBUI_FEATURE_FAVICONS=1 << 6,
+  WEBUI_FEATURE_MODAL_DIALOGS=1 << 7
+};
+/* every optional feature off, for minimal memory and startup time */
+#define WEBUI_PROFILE_LEAN 0xff
+
+enum webui_data_type{
+  WEBUI_DATA_CACHE=1 << 0,
+  WEBUI_DATA_STORAGE=1 << 1,
+  WEBUI_DATA_COOKIES=1 << 2,
+  WEBUI_DATA_ALL=7
+};
+
+enum webui_show_mode{
+  WEBUI_SHOW_IMMEDIATE=0,
+  WEBUI_SHOW_ON_COMMIT=1, /* first content of the page is committed */
+  WEBUI_SHOW_ON_LOAD=2,
+  WEBUI_SHOW_ON_READY=3 /* webui_ready() or window.external.ready() */
+};
+
+enum webui_load_event{
+  WEBUI_LOAD_STARTED=0,
+  WEBUI_LOAD_REDIRECTED=1,
+  WEBUI_LOAD_COMMITTED=2,
+  WEBUI_LOAD_FINISHED=3,
+  WEBUI_LOAD_FAILED=4,
+  WEBUI_LOAD_TIMING=5 /* navigation and resource timing, after finished */
+};
+
+enum webui_recover_reason{
+  WEBUI_RECOVER_CRASHED=0,
+  WEBUI_RECOVER_OUT_OF_MEMORY=1,
+  WEBUI_RECOVER_UNRESPONSIVE=2 /* killed after hang_timeout */
+};
+
+/* commands of webui_batch_exec(), see there for the buffer layout */
+enum webui_batch_op{
+  WEBUI_BATCH_EVAL=1,
+  WEBUI_BATCH_INJECT_CSS=2,
+  WEBUI_BATCH_SET_TITLE=3,
+  WEBUI_BATCH_SET_COLOR=4,      /* arg is 0xRRGGBBAA */
+  WEBUI_BATCH_SET_FULLSCREEN=5, /* arg is 0 or 1 */
+  WEBUI_BATCH_STYLE_REPLACE=6   /* arg is the style sheet id */
+};
+
+enum webui_snapshot_format{
+  WEBUI_SNAPSHOT_RGBA=0,
+  WEBUI_SNAPSHOT_PNG=1
+};
+
 struct webui {
   const char *url;
   const char *title;
@@ -44,8 +226,36 @@ struct webui {
   int minHeight;
   int border;
   int debug;
+  /* web process tuning, shared by all windows and taken from the first one */
+  int cache_model;
+  int process_model;
+  int memory_limit; /* MB, 0 is the WebKit default */
+  double memory_conservative_threshold;
+  double memory_strict_threshold;
+  double memory_kill_threshold;
+  unsigned int disabled_features; /* enum webui_feature bits */
+  /* persistent website data and HTTP cache, NULL for the defaults */
+  const char *data_dir;
+  const char *cache_dir;
+  int cache_purge; /* MB, the disk cache is cleared at startup above it */
+  int show_mode;
+  int show_timeout; /* ms before the window is shown anyway, 0 is 3000 */
+  int offscreen;
+  int input_latency; /* measure input latency into the stats */
+  /* while hidden: suspend the frame callback and defer webui_eval() */
+  int throttle_hidden;
+  int eval_timeout; /* ms before webui_eval() gives up, 0 waits forever */
+  int hang_timeout; /* ms an unresponsive web process is given, 0 forever,
+                       ignored before WebKit 2.34 */
+  /* inline HTML loaded instead of url, base_uri resolves its relative URLs */
+  const char *html;
+  size_t html_len;
+  const char *base_uri;
   webui_external_invoke_cb_t external_invoke_cb;
   webui_close_cb close_cb;
+  webui_load_cb load_cb;
+  webui_visibility_cb visibility_cb;
+  webui_recover_cb recover_cb;
   struct webui_priv priv;
   void *userdata;
 };
@@ -78,12 +288,24 @@ enum webui_file_type{
   WEBUI_FILE_DIRECTORY=2
 };
 
+struct webui_surface;
+
+struct webui_surface_stats {
+  uint64_t committed;
+  uint64_t presented;
+  uint64_t dropped;
+  int64_t latency_last; /* commit to hand-off to the page, microseconds */
+  int64_t latency_avg;
+  int64_t latency_max;
+};
+
 typedef void (*webui_dispatch_fn)(struct webui *w, void *arg);
 
 struct webui_dispatch_arg {
   webui_dispatch_fn fn;
   struct webui *w;
   void *arg;
+  int64_t queued;
 };
 
 #define DEFAULT_URL                                                            \
@@ -94,6 +316,32 @@ struct webui_dispatch_arg {
   "3E%3C%2Fdiv%3E%3Cscript%20type=%22text%2Fjavascript%22%3E%3C%2Fscript%3E%"  \
   "3C%2Fbody%3E%0A%3C%2Fhtml%3E"
 
+#define WEBUI_EXTERNAL_JS                                                      \
+  "window.external={invoke:function(x){"                                       \
+  "window.webkit.messageHandlers.external.postMessage(x);},"                   \
+  "ready:function(){window.webkit.messageHandlers.ready.postMessage('');}}"
+
+/* with input_latency: posted once the frame that follows an input, with the
+ * changes its handlers made, has been painted by the web process */
+#define WEBUI_INPUT_JS                                                         \
+  "(function(){var busy=false;function done(){busy=false;"                     \
+  "window.webkit.messageHandlers.input.postMessage('');}"                      \
+  "function input(){if(busy){return;}busy=true;"                               \
+  "requestAnimationFrame(function(){setTimeout(done,0);});}"                   \
+  "['mousedown','keydown','touchstart','wheel'].forEach(function(t){"          \
+  "window.addEventListener(t,input,{capture:true,passive:true});});})()"
+
+/* posted once the load event handlers have run, so loadEventEnd is set */
+#define WEBUI_LOAD_TIMING_JS                                                   \
+  "setTimeout(function(){var p=window.performance;"                           \
+  "if(!p||!p.getEntriesByType){return;}"                                       \
+  "var j=function(e){return e.toJSON();},"                                     \
+  "n=p.getEntriesByType('navigation').map(j);"                                 \
+  "window.webkit.messageHandlers.timing.postMessage(JSON.stringify({"          \
+  "timeOrigin:p.timeOrigin||p.timing.navigationStart,"                         \
+  "navigation:n.length?n:[p.timing.toJSON()],"                                 \
+  "resource:p.getEntriesByType('resource').map(j)}));},0)"
+
 #define CSS_INJECT_FUNCTION                                                    \
   "(function(e){var "                                                          \
   "t=document.createElement('style'),d=document.head||document."               \
@@ -112,18 +360,67 @@ WEBUI_API int webui(const char *title, const char *url, int width, int height, i
 WEBUI_API int webui_init(struct webui *w);
 WEBUI_API int webui_loop(struct webui *w, int blocking);
 WEBUI_API int webui_eval(struct webui *w, const char *js);
+WEBUI_API int webui_eval_result(struct webui *w, const char *js, char **result);
+WEBUI_API int webui_eval_n(struct webui *w, const char *js, size_t len);
+WEBUI_API int webui_eval_result_n(struct webui *w, const char *js, size_t len,
+                                  char **result);
+WEBUI_API int webui_eval_async(struct webui *w, const char *js, size_t len);
+WEBUI_API int webui_eval_timeout(struct webui *w, const char *js, size_t len,
+                                 int timeout, struct webui_cancel *cancel,
+                                 char **result);
+WEBUI_API void webui_eval_cancel(struct webui_cancel *cancel);
+WEBUI_API int webui_wait_ready(struct webui *w, int timeout);
+WEBUI_API int webui_iterate(int blocking);
+WEBUI_API void webui_wakeup(void);
 WEBUI_API int webui_inject_css(struct webui *w, const char *css);
+WEBUI_API int webui_inject_css_n(struct webui *w, const char *css, size_t len);
+WEBUI_API int webui_add_user_script(struct webui *w, const char *js);
+WEBUI_API void webui_register_library(const char *name, const char *js);
+WEBUI_API int webui_use_library(struct webui *w, const char *name);
+WEBUI_API int webui_style_add(struct webui *w, const char *css);
+WEBUI_API int webui_style_replace(struct webui *w, int id, const char *css);
+WEBUI_API int webui_style_replace_n(struct webui *w, int id, const char *css,
+                                  size_t len);
+WEBUI_API int webui_style_remove(struct webui *w, int id);
+WEBUI_API int webui_batch_exec(struct webui *w, const char *buf, size_t len,
+                               int *results, int nresults);
 WEBUI_API void webui_set_title(struct webui *w, const char *title);
+WEBUI_API void webui_set_title_n(struct webui *w, const char *title,
+                                 size_t len);
+WEBUI_API void webui_ready(struct webui *w);
+WEBUI_API void webui_get_startup(struct webui *w, struct webui_startup *startup);
+WEBUI_API void webui_navigate(struct webui *w, const char *url);
+WEBUI_API void webui_load_html(struct webui *w, const char *html, size_t len,
+                               const char *base_uri);
+WEBUI_API void webui_prerender(struct webui *w, const char *url);
 WEBUI_API void webui_set_fullscreen(struct webui *w, int fullscreen);
 WEBUI_API void webui_set_color(struct webui *w, uint8_t r, uint8_t g, uint8_t b, uint8_t a);
+WEBUI_API void webui_on_frame(struct webui *w, webui_frame_cb cb);
 WEBUI_API void webui_dispatch(struct webui *w, webui_dispatch_fn fn, void *arg);
 WEBUI_API void webui_terminate(struct webui *w);
 WEBUI_API void webui_exit(struct webui *w);
 WEBUI_API void webui_debug(const char *format, ...);
 WEBUI_API void webui_print_log(const char *s);
 WEBUI_API void webui_set_min_size(struct webui *w,int width,int height);
+WEBUI_API void webui_purge_caches(struct webui *w);
+WEBUI_API void webui_clear_data(struct webui *w, int types);
 WEBUI_API int webui_msg(struct webui *w,enum webui_msg_type flag,const char *title,const char *msg);
+WEBUI_API int webui_msg_n(struct webui *w, enum webui_msg_type flag,
+                          const char *title, size_t title_len, const char *msg,
+                          size_t msg_len);
 WEBUI_API void webui_file(struct webui *w,enum webui_file_type flag,const char *filter,char *result, size_t resultsz);
+WEBUI_API struct webui_surface *webui_surface_new(struct webui *w, const char *canvas, int width, int height);
+WEBUI_API uint8_t *webui_surface_pixels(struct webui_surface *s);
+WEBUI_API int webui_surface_commit(struct webui_surface *s);
+WEBUI_API void webui_surface_stats(struct webui_surface *s, struct webui_surface_stats *stats);
+WEBUI_API void webui_surface_free(struct webui_surface *s);
+WEBUI_API int webui_snapshot(struct webui *w, int format, int full_document, uint8_t **data, size_t *len, int *width, int *height);
+WEBUI_API void webui_trace_enable(int capacity);
+WEBUI_API int64_t webui_trace_now(void);
+WEBUI_API void webui_trace_add(struct webui *w, const char *cat, const char *name, int64_t ts, int64_t dur, int64_t size);
+WEBUI_API int webui_trace_collect_page(struct webui *w);
+WEBUI_API int webui_trace_dump(const char *path);
+WEBUI_API void webui_get_stats(struct webui *w, struct webui_stats *stats);
 
 
 WEBUI_API int webui(const char *title, const char *url, int width, int height, int border) {
@@ -153,44 +450,413 @@ WEBUI_API void webui_debug(const char *format, ...) {
   va_end(ap);
 }
 
-static int webui_js_encode(const char *s, char *esc, size_t n) {
-  int r = 1; /* At least one byte for trailing zero */
+/*
+ * Tracing records spans of eval, invoke, dispatch and page loads into a ring
+ * buffer that keeps the most recent events. Timestamps are microseconds of
+ * the monotonic clock and the buffer is dumped in the Chrome Trace Event
+ * format, which chrome://tracing and Perfetto load directly.
+ */
+struct webui_trace_event {
+  char name[48];
+  char cat[16];
+  int64_t ts;
+  int64_t dur;
+  int64_t size;
+  int window;
+};
+
+G_LOCK_DEFINE_STATIC(webui_trace);
+static struct webui_trace_event *webui_trace_buf = NULL;
+static int webui_trace_cap = 0;
+static int webui_trace_len = 0;
+static int webui_trace_head = 0;
+static volatile int webui_trace_on = 0;
+static int webui_last_id = 0;
+
+WEBUI_API void webui_trace_enable(int capacity) {
+  G_LOCK(webui_trace);
+  g_free(webui_trace_buf);
+  webui_trace_buf = NULL;
+  webui_trace_cap = webui_trace_len = webui_trace_head = 0;
+  if (capacity > 0) {
+    webui_trace_buf = g_new0(struct webui_trace_event, capacity);
+    webui_trace_cap = capacity;
+  }
+  webui_trace_on = capacity > 0;
+  G_UNLOCK(webui_trace);
+}
+
+WEBUI_API int64_t webui_trace_now(void) { return g_get_monotonic_time(); }
+
+WEBUI_API void webui_trace_add(struct webui *w, const char *cat,
+                               const char *name, int64_t ts, int64_t dur,
+                               int64_t size) {
+  if (!webui_trace_on) {
+    return;
+  }
+  G_LOCK(webui_trace);
+  if (webui_trace_cap > 0) {
+    struct webui_trace_event *e =
+        &webui_trace_buf[(webui_trace_head + webui_trace_len) % webui_trace_cap];
+    if (webui_trace_len < webui_trace_cap) {
+      webui_trace_len++;
+    } else {
+      webui_trace_head = (webui_trace_head + 1) % webui_trace_cap;
+    }
+    g_strlcpy(e->name, name, sizeof(e->name));
+    g_strlcpy(e->cat, cat, sizeof(e->cat));
+    e->ts = ts;
+    e->dur = dur;
+    e->size = size;
+    e->window = w != NULL ? w->priv.id : 0;
+  }
+  G_UNLOCK(webui_trace);
+}
+
+/* starts a span, 0 when tracing is off */
+static int64_t webui_trace_begin(void) {
+  return webui_trace_on ? g_get_monotonic_time() : 0;
+}
+
+static void webui_trace_end(struct webui *w, const char *cat, const char *name,
+                            int64_t ts, int64_t size) {
+  if (ts != 0 && webui_trace_on) {
+    webui_trace_add(w, cat, name, ts, g_get_monotonic_time() - ts, size);
+  }
+}
+
+/* counters are updated with relaxed atomics, dispatch runs on any thread */
+#define webui_stats_add(field, n) __atomic_fetch_add(&(field), (n), __ATOMIC_RELAXED)
+
+static void webui_stats_record(uint64_t *histogram, int64_t us) {
+  const int sub = 1 << WEBUI_HISTOGRAM_SUB_BITS;
+  int i;
+  if (us < sub) {
+    i = us < 0 ? 0 : (int)us;
+  } else {
+    int msb = 0;
+    for (int64_t v = us; v > 1; v >>= 1) {
+      msb++;
+    }
+    int shift = msb - WEBUI_HISTOGRAM_SUB_BITS;
+    i = sub + shift * sub + (int)((us >> shift) & (sub - 1));
+    if (i > WEBUI_HISTOGRAM_BUCKETS - 1) {
+      i = WEBUI_HISTOGRAM_BUCKETS - 1;
+    }
+  }
+  webui_stats_add(histogram[i], 1);
+}
+
+/* CPU time of this process, the web process is not included */
+static int64_t webui_cpu_time(void) {
+  struct rusage ru;
+  if (getrusage(RUSAGE_SELF, &ru) != 0) {
+    return 0;
+  }
+  return (int64_t)(ru.ru_utime.tv_sec + ru.ru_stime.tv_sec) * 1000000 +
+         ru.ru_utime.tv_usec + ru.ru_stime.tv_usec;
+}
+
+WEBUI_API void webui_get_stats(struct webui *w, struct webui_stats *stats) {
+  struct webui_stats *s = &w->priv.stats;
+  stats->evals = __atomic_load_n(&s->evals, __ATOMIC_RELAXED);
+  stats->invokes = __atomic_load_n(&s->invokes, __ATOMIC_RELAXED);
+  stats->dispatches = __atomic_load_n(&s->dispatches, __ATOMIC_RELAXED);
+  stats->bytes_to_page = __atomic_load_n(&s->bytes_to_page, __ATOMIC_RELAXED);
+  stats->bytes_from_page =
+      __atomic_load_n(&s->bytes_from_page, __ATOMIC_RELAXED);
+  stats->queue_depth = g_async_queue_length(w->priv.queue);
+  stats->evals_in_flight =
+      __atomic_load_n(&s->evals_in_flight, __ATOMIC_RELAXED);
+  for (int i = 0; i < WEBUI_HISTOGRAM_BUCKETS; i++) {
+    stats->eval_latency[i] =
+        __atomic_load_n(&s->eval_latency[i], __ATOMIC_RELAXED);
+    stats->invoke_latency[i] =
+        __atomic_load_n(&s->invoke_latency[i], __ATOMIC_RELAXED);
+    stats->dispatch_latency[i] =
+        __atomic_load_n(&s->dispatch_latency[i], __ATOMIC_RELAXED);
+    stats->input_paint_latency[i] =
+        __atomic_load_n(&s->input_paint_latency[i], __ATOMIC_RELAXED);
+    stats->input_handler_latency[i] =
+        __atomic_load_n(&s->input_handler_latency[i], __ATOMIC_RELAXED);
+  }
+  stats->inputs = __atomic_load_n(&s->inputs, __ATOMIC_RELAXED);
+  stats->deferred_evals =
+      __atomic_load_n(&s->deferred_evals, __ATOMIC_RELAXED);
+  stats->eval_timeouts = __atomic_load_n(&s->eval_timeouts, __ATOMIC_RELAXED);
+  stats->eval_cancels = __atomic_load_n(&s->eval_cancels, __ATOMIC_RELAXED);
+  g_mutex_lock(&w->priv.visibility_lock);
+  stats->visible_time = s->visible_time;
+  stats->hidden_time = s->hidden_time;
+  stats->cpu_visible = s->cpu_visible;
+  stats->cpu_hidden = s->cpu_hidden;
+  /* add the time since the last visibility change */
+  int64_t t = g_get_monotonic_time() - w->priv.visible_since;
+  int64_t cpu = webui_cpu_time() - w->priv.cpu_since;
+  if (w->priv.visible) {
+    stats->visible_time += t;
+    stats->cpu_visible += cpu;
+  } else {
+    stats->hidden_time += t;
+    stats->cpu_hidden += cpu;
+  }
+  g_mutex_unlock(&w->priv.visibility_lock);
+}
+
+static void webui_trace_write_string(FILE *f, const char *s) {
+  fputc('"', f);
   for (; *s; s++) {
     const unsigned char c = *s;
-    if (c >= 0x20 && c < 0x80 && strchr("<>\\'\"", c) == NULL) {
-      if (n > 0) {
-        *esc++ = c;
-        n--;
-      }
-      r++;
+    if (c == '"' || c == '\\') {
+      fprintf(f, "\\%c", c);
+    } else if (c < 0x20) {
+      fprintf(f, "\\u%04x", c);
     } else {
-      if (n > 0) {
-        snprintf(esc, n, "\\x%02x", (int)c);
-        esc += 4;
-        n -= 4;
-      }
-      r += 4;
+      fputc(c, f);
     }
   }
-  return r;
+  fputc('"', f);
 }
 
-WEBUI_API int webui_inject_css(struct webui *w, const char *css) {
-  int n = webui_js_encode(css, NULL, 0);
-  char *esc = (char *)calloc(1, sizeof(CSS_INJECT_FUNCTION) + n + 4);
-  if (esc == NULL) {
+WEBUI_API int webui_trace_dump(const char *path) {
+  FILE *f = fopen(path, "w");
+  if (f == NULL) {
     return -1;
   }
-  char *js = (char *)calloc(1, n);
-  webui_js_encode(css, js, n);
-  snprintf(esc, sizeof(CSS_INJECT_FUNCTION) + n + 4, "%s(\"%s\")",
-           CSS_INJECT_FUNCTION, js);
-  int r = webui_eval(w, esc);
-  free(js);
-  free(esc);
+  fprintf(f, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+  fprintf(f, "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":1,"
+             "\"args\":{\"name\":\"webui\"}}");
+  G_LOCK(webui_trace);
+  for (int i = 0; i < webui_trace_len; i++) {
+    struct webui_trace_event *e =
+        &webui_trace_buf[(webui_trace_head + i) % webui_trace_cap];
+    fprintf(f, ",\n{\"name\":");
+    webui_trace_write_string(f, e->name);
+    fprintf(f, ",\"cat\":");
+    webui_trace_write_string(f, e->cat);
+    fprintf(f,
+            ",\"ph\":\"X\",\"pid\":1,\"tid\":%d,\"ts\":%" G_GINT64_FORMAT
+            ",\"dur\":%" G_GINT64_FORMAT ",\"args\":{\"size\":%" G_GINT64_FORMAT
+            "}}",
+            e->window, e->ts, e->dur, e->size);
+  }
+  G_UNLOCK(webui_trace);
+  fprintf(f, "\n]}\n");
+  return fclose(f) == 0 ? 0 : -1;
+}
+
+WEBUI_API int webui_inject_css(struct webui *w, const char *css) {
+  return webui_inject_css_n(w, css, strlen(css));
+}
+
+WEBUI_API int webui_inject_css_n(struct webui *w, const char *css,
+                                 size_t len) {
+  struct webui_buf js = {NULL, 0, 0};
+  int r = -1;
+  if (webui_buf_append_str(&js, CSS_INJECT_FUNCTION "(\"") == 0 &&
+      webui_buf_append_js(&js, css, len) == 0 &&
+      webui_buf_append_str(&js, "\")") == 0) {
+    r = webui_eval(w, js.data);
+  }
+  free(js.data);
   return r;
 }
 
+/* runs a zero terminated script without waiting for it */
+static void webui_view_run(GtkWidget *view, const char *js) {
+#if WEBKIT_CHECK_VERSION(2, 40, 0)
+  webkit_web_view_evaluate_javascript(WEBKIT_WEB_VIEW(view), js, -1, NULL,
+                                      NULL, NULL, NULL, NULL);
+#else
+  webkit_web_view_run_javascript(WEBKIT_WEB_VIEW(view), js, NULL, NULL, NULL);
+#endif
+}
+
+/*
+ * Runs a script that was just added to the content manager in the documents
+ * that are already there: the committed page and the screens. Screens share
+ * the content manager but keep their documents until they load again. A
+ * screen that has not committed yet runs it in the blank document it is
+ * about to replace, which is harmless.
+ */
+static void webui_inject_all(struct webui *w, const char *js) {
+  if (w->priv.committed) {
+    webui_view_run(w->priv.webui, js);
+  }
+  for (int i = 0; i < WEBUI_SCREEN_CACHE; i++) {
+    if (w->priv.screens[i].view != NULL) {
+      webui_view_run(w->priv.screens[i].view, js);
+    }
+  }
+}
+
+/*
+ * User scripts run at the start of every document loaded in the window and
+ * its screens, before the page's own scripts. A document that is already
+ * there gets the script once right away.
+ */
+/* the caller owns the returned reference */
+static WebKitUserScript *webui_user_script_new(struct webui *w,
+                                               const char *js) {
+  WebKitUserScript *script = webkit_user_script_new(
+      js, WEBKIT_USER_CONTENT_INJECT_TOP_FRAME,
+      WEBKIT_USER_SCRIPT_INJECT_AT_DOCUMENT_START, NULL, NULL);
+  webkit_user_content_manager_add_script(w->priv.content, script);
+  webui_inject_all(w, js);
+  return script;
+}
+
+WEBUI_API int webui_add_user_script(struct webui *w, const char *js) {
+  webkit_user_script_unref(webui_user_script_new(w, js));
+  return 0;
+}
+
+/*
+ * Libraries are registered once per process and shared by all windows: each
+ * window adds the same WebKitUserScript to its content manager, so the
+ * source is neither copied per window nor sent again on reloads.
+ */
+struct webui_library {
+  char *source;
+  WebKitUserScript *script;
+};
+
+static GHashTable *webui_libraries = NULL;
+
+static void webui_library_free(gpointer data) {
+  struct webui_library *lib = (struct webui_library *)data;
+  webkit_user_script_unref(lib->script);
+  g_free(lib->source);
+  g_free(lib);
+}
+
+WEBUI_API void webui_register_library(const char *name, const char *js) {
+  if (webui_libraries == NULL) {
+    webui_libraries = g_hash_table_new_full(g_str_hash, g_str_equal, g_free,
+                                            webui_library_free);
+  }
+  if (g_hash_table_contains(webui_libraries, name)) {
+    return;
+  }
+  struct webui_library *lib = g_new0(struct webui_library, 1);
+  lib->source = g_strdup(js);
+  lib->script = webkit_user_script_new(
+      lib->source, WEBKIT_USER_CONTENT_INJECT_TOP_FRAME,
+      WEBKIT_USER_SCRIPT_INJECT_AT_DOCUMENT_START, NULL, NULL);
+  g_hash_table_insert(webui_libraries, g_strdup(name), lib);
+}
+
+WEBUI_API int webui_use_library(struct webui *w, const char *name) {
+  struct webui_library *lib =
+      webui_libraries != NULL
+          ? (struct webui_library *)g_hash_table_lookup(webui_libraries, name)
+          : NULL;
+  if (lib == NULL) {
+    return -1;
+  }
+  if (w->priv.libraries == NULL) {
+    w->priv.libraries = g_hash_table_new_full(g_str_hash, g_str_equal, g_free,
+                                              NULL);
+  }
+  if (g_hash_table_contains(w->priv.libraries, name)) {
+    return 0;
+  }
+  g_hash_table_add(w->priv.libraries, g_strdup(name));
+  webkit_user_content_manager_add_script(w->priv.content, lib->script);
+  webui_inject_all(w, lib->source);
+  return 0;
+}
+
+/*
+ * Style sheets live in the content manager: WebKit parses them once,
+ * applies them to the current page right away and to every page loaded
+ * later, and replacing one does not leave the old rules behind.
+ */
+static void webui_style_readd(gpointer key, gpointer value, gpointer data) {
+  (void)key;
+  webkit_user_content_manager_add_style_sheet(
+      (WebKitUserContentManager *)data, (WebKitUserStyleSheet *)value);
+}
+
+static void webui_style_unlink(struct webui *w, WebKitUserStyleSheet *sheet) {
+#if WEBKIT_CHECK_VERSION(2, 32, 0)
+  webkit_user_content_manager_remove_style_sheet(w->priv.content, sheet);
+#else
+  (void)sheet;
+  webkit_user_content_manager_remove_all_style_sheets(w->priv.content);
+  g_hash_table_foreach(w->priv.styles, webui_style_readd, w->priv.content);
+#endif
+}
+
+static WebKitUserStyleSheet *webui_style_new(const char *css) {
+  return webkit_user_style_sheet_new(css, WEBKIT_USER_CONTENT_INJECT_TOP_FRAME,
+                                     WEBKIT_USER_STYLE_LEVEL_AUTHOR, NULL,
+                                     NULL);
+}
+
+WEBUI_API int webui_style_add(struct webui *w, const char *css) {
+  if (w->priv.styles == NULL) {
+    w->priv.styles = g_hash_table_new_full(
+        g_direct_hash, g_direct_equal, NULL,
+        (GDestroyNotify)webkit_user_style_sheet_unref);
+  }
+  WebKitUserStyleSheet *sheet = webui_style_new(css);
+  int id = ++w->priv.styles_next;
+  g_hash_table_insert(w->priv.styles, GINT_TO_POINTER(id), sheet);
+  webkit_user_content_manager_add_style_sheet(w->priv.content, sheet);
+  return id;
+}
+
+WEBUI_API int webui_style_replace(struct webui *w, int id, const char *css) {
+  WebKitUserStyleSheet *old =
+      w->priv.styles != NULL
+          ? (WebKitUserStyleSheet *)g_hash_table_lookup(w->priv.styles,
+                                                        GINT_TO_POINTER(id))
+          : NULL;
+  if (old == NULL) {
+    return -1;
+  }
+  WebKitUserStyleSheet *sheet = webui_style_new(css);
+  webkit_user_style_sheet_ref(old);
+  g_hash_table_insert(w->priv.styles, GINT_TO_POINTER(id), sheet);
+#if WEBKIT_CHECK_VERSION(2, 32, 0)
+  webkit_user_content_manager_remove_style_sheet(w->priv.content, old);
+  webkit_user_content_manager_add_style_sheet(w->priv.content, sheet);
+#else
+  webui_style_unlink(w, old);
+#endif
+  webkit_user_style_sheet_unref(old);
+  return 0;
+}
+
+/* WebKit takes a C string, it is terminated in the per-window buffer */
+WEBUI_API int webui_style_replace_n(struct webui *w, int id, const char *css,
+                                   size_t len) {
+  w->priv.script.len = 0;
+  if (webui_buf_append(&w->priv.script, css, len) != 0) {
+    return -1;
+  }
+  return webui_style_replace(w, id, w->priv.script.data);
+}
+
+WEBUI_API int webui_style_remove(struct webui *w, int id) {
+  WebKitUserStyleSheet *sheet =
+      w->priv.styles != NULL
+          ? (WebKitUserStyleSheet *)g_hash_table_lookup(w->priv.styles,
+                                                        GINT_TO_POINTER(id))
+          : NULL;
+  if (sheet == NULL) {
+    return -1;
+  }
+  webkit_user_style_sheet_ref(sheet);
+  g_hash_table_remove(w->priv.styles, GINT_TO_POINTER(id));
+  webui_style_unlink(w, sheet);
+  webkit_user_style_sheet_unref(sheet);
+  return 0;
+}
+
+#include "batch.h"
+
 static void external_message_received_cb(WebKitUserContentManager *m,
                                          WebKitJavascriptResult *r,
                                          gpointer arg) {
@@ -201,22 +867,201 @@ static void external_message_received_cb(WebKitUserContentManager *m,
   }
   JSCValue * value = webkit_javascript_result_get_js_value(r);
   char *s=jsc_value_to_string (value);
+  size_t n = strlen(s);
+  int64_t ts = g_get_monotonic_time();
+  if (w->priv.input_handler_pending != 0) {
+    webui_stats_record(w->priv.stats.input_handler_latency,
+                       ts - w->priv.input_handler_pending);
+    w->priv.input_handler_pending = 0;
+  }
   w->external_invoke_cb(w, s);
+  webui_stats_add(w->priv.stats.invokes, 1);
+  webui_stats_add(w->priv.stats.bytes_from_page, n);
+  webui_stats_record(w->priv.stats.invoke_latency, g_get_monotonic_time() - ts);
+  webui_trace_end(w, "ipc", "invoke", ts, n);
+  g_free(s);
+}
+
+static void webui_show(struct webui *w) {
+  if (w->priv.startup.shown != 0) {
+    return;
+  }
+  if (w->priv.show_timer != 0) {
+    g_source_remove(w->priv.show_timer);
+    w->priv.show_timer = 0;
+  }
+  gtk_widget_show(w->priv.window);
+  w->priv.startup.shown = g_get_monotonic_time();
+}
+
+static gboolean webui_show_timeout_cb(gpointer arg) {
+  struct webui *w = (struct webui *)arg;
+  w->priv.show_timer = 0;
+  webui_show(w);
+  return G_SOURCE_REMOVE;
+}
+
+static void ready_message_received_cb(WebKitUserContentManager *m,
+                                      WebKitJavascriptResult *r,
+                                      gpointer arg) {
+  (void)m;
+  (void)r;
+  webui_ready((struct webui *)arg);
+}
+
+static void timing_message_received_cb(WebKitUserContentManager *m,
+                                       WebKitJavascriptResult *r,
+                                       gpointer arg) {
+  (void)m;
+  struct webui *w = (struct webui *)arg;
+  if (w->load_cb == NULL) {
+    return;
+  }
+  char *s = jsc_value_to_string(webkit_javascript_result_get_js_value(r));
+  w->load_cb(w, WEBUI_LOAD_TIMING, g_get_monotonic_time(),
+             webkit_web_view_get_uri(WEBKIT_WEB_VIEW(w->priv.webui)), s);
   g_free(s);
 }
 
+static gboolean webui_load_failed_cb(WebKitWebView *webui,
+                                     WebKitLoadEvent event, gchar *uri,
+                                     GError *error, gpointer arg) {
+  (void)event;
+  struct webui *w = (struct webui *)arg;
+  if (GTK_WIDGET(webui) == w->priv.webui && w->load_cb != NULL) {
+    w->load_cb(w, WEBUI_LOAD_FAILED, g_get_monotonic_time(), uri,
+               error->message);
+  }
+  return FALSE;
+}
+
 static void webui_load_changed_cb(WebKitWebView *webui,
                                     WebKitLoadEvent event, gpointer arg) {
-  (void)webui;
   struct webui *w = (struct webui *)arg;
+  if (GTK_WIDGET(webui) != w->priv.webui) {
+    /* screens only track their commit for when they are swapped in */
+    for (int i = 0; i < WEBUI_SCREEN_CACHE; i++) {
+      struct webui_screen *s = &w->priv.screens[i];
+      if (s->view == GTK_WIDGET(webui) && event == WEBKIT_LOAD_STARTED) {
+        s->committed = 0;
+      } else if (s->view == GTK_WIDGET(webui) &&
+                 event == WEBKIT_LOAD_COMMITTED) {
+        s->committed = 1;
+      }
+    }
+    return;
+  }
+  if (w->load_cb != NULL) {
+    static const int events[] = {WEBUI_LOAD_STARTED, WEBUI_LOAD_REDIRECTED,
+                                 WEBUI_LOAD_COMMITTED, WEBUI_LOAD_FINISHED};
+    w->load_cb(w, events[event], g_get_monotonic_time(),
+               webkit_web_view_get_uri(webui), NULL);
+    if (event == WEBKIT_LOAD_FINISHED) {
+      webkit_web_view_run_javascript(webui, WEBUI_LOAD_TIMING_JS, NULL, NULL,
+                                     NULL);
+    }
+  }
+  if (event == WEBKIT_LOAD_STARTED) {
+    w->priv.load_started = webui_trace_begin();
+    w->priv.committed = 0;
+  }
+  if (event == WEBKIT_LOAD_COMMITTED) {
+    webui_trace_end(w, "load", "load_committed", w->priv.load_started, 0);
+    w->priv.committed = 1;
+    if (w->priv.startup.committed == 0) {
+      w->priv.startup.committed = g_get_monotonic_time();
+    }
+    if (w->show_mode == WEBUI_SHOW_ON_COMMIT) {
+      webui_show(w);
+    }
+  }
   if (event == WEBKIT_LOAD_FINISHED) {
+    webui_trace_end(w, "load", "load", w->priv.load_started, 0);
+    w->priv.load_started = 0;
     w->priv.ready = 1;
+    if (w->priv.startup.finished == 0) {
+      w->priv.startup.finished = g_get_monotonic_time();
+    }
+    if (w->show_mode == WEBUI_SHOW_ON_LOAD) {
+      webui_show(w);
+    }
+  }
+  if (event == WEBKIT_LOAD_FINISHED && w->priv.recovering) {
+    int reason = w->priv.recovering - 1;
+    w->priv.recovering = 0;
+    if (w->recover_cb != NULL) {
+      w->recover_cb(w, reason);
+    }
+  }
+}
+
+/*
+ * The watchdog reloads the page when the web process crashed or was killed
+ * for being unresponsive longer than hang_timeout. Pending evals fail at
+ * once, user scripts are injected into the new page as into any other and
+ * recover_cb runs when it has loaded.
+ */
+static void webui_web_process_terminated_cb(WebKitWebView *webui,
+                                            WebKitWebProcessTerminationReason reason,
+                                            gpointer arg) {
+  struct webui *w = (struct webui *)arg;
+  if (GTK_WIDGET(webui) != w->priv.webui) {
+    return;
+  }
+  if (w->priv.hang_timer != 0) {
+    g_source_remove(w->priv.hang_timer);
+    w->priv.hang_timer = 0;
+  }
+  if (w->priv.hang_killed) {
+    w->priv.recovering = WEBUI_RECOVER_UNRESPONSIVE + 1;
+  } else if (reason == WEBKIT_WEB_PROCESS_EXCEEDED_MEMORY_LIMIT) {
+    w->priv.recovering = WEBUI_RECOVER_OUT_OF_MEMORY + 1;
+  } else {
+    w->priv.recovering = WEBUI_RECOVER_CRASHED + 1;
   }
+  w->priv.hang_killed = 0;
+  w->priv.generation++;
+  w->priv.ready = 0;
+  webkit_web_view_reload(webui);
+}
+
+#if WEBKIT_CHECK_VERSION(2, 34, 0)
+static gboolean webui_hang_timeout_cb(gpointer arg) {
+  struct webui *w = (struct webui *)arg;
+  WebKitWebView *view = WEBKIT_WEB_VIEW(w->priv.webui);
+  w->priv.hang_timer = 0;
+  if (!webkit_web_view_get_is_web_process_responsive(view)) {
+    w->priv.hang_killed = 1;
+    webkit_web_view_terminate_web_process(view);
+  }
+  return G_SOURCE_REMOVE;
 }
 
+static void webui_responsive_cb(GObject *object, GParamSpec *pspec,
+                                gpointer arg) {
+  (void)pspec;
+  struct webui *w = (struct webui *)arg;
+  WebKitWebView *view = WEBKIT_WEB_VIEW(object);
+  if (GTK_WIDGET(view) != w->priv.webui || w->hang_timeout <= 0) {
+    return;
+  }
+  if (!webkit_web_view_get_is_web_process_responsive(view)) {
+    if (w->priv.hang_timer == 0) {
+      w->priv.hang_timer =
+          g_timeout_add(w->hang_timeout, webui_hang_timeout_cb, w);
+    }
+  } else if (w->priv.hang_timer != 0) {
+    g_source_remove(w->priv.hang_timer);
+    w->priv.hang_timer = 0;
+  }
+}
+#endif
+
 static void webui_destroy_cb(GtkWidget *widget, gpointer arg) {
   (void)widget;
   struct webui *w = (struct webui *)arg;
+  w->priv.destroyed = 1;
+  w->priv.frame_tick = 0;
   webui_terminate(w);
 }
 
@@ -232,17 +1077,360 @@ static gboolean webui_delete_event_cb(GtkWidget *widget,GdkEvent  *event, gpoint
   return false;
 }
 
-static gboolean webui_context_menu_cb(WebKitWebView *webui,
-                                        GtkWidget *default_menu,
-                                        WebKitHitTestResult *hit_test_result,
-                                        gboolean triggered_with_keyboard,
-                                        gpointer userdata) {
-  (void)webui;
-  (void)default_menu;
-  (void)hit_test_result;
-  (void)triggered_with_keyboard;
-  (void)userdata;
-  return TRUE;
+static gboolean webui_context_menu_cb(WebKitWebView *webui,
+                                        GtkWidget *default_menu,
+                                        WebKitHitTestResult *hit_test_result,
+                                        gboolean triggered_with_keyboard,
+                                        gpointer userdata) {
+  (void)webui;
+  (void)default_menu;
+  (void)hit_test_result;
+  (void)triggered_with_keyboard;
+  (void)userdata;
+  return TRUE;
+}
+
+static gboolean webui_script_dialog_cb(WebKitWebView *webui,
+                                       WebKitScriptDialog *dialog,
+                                       gpointer arg) {
+  (void)webui;
+  (void)dialog;
+  (void)arg;
+  /* alert() returns, confirm() is false and prompt() is null */
+  return TRUE;
+}
+
+static void webui_apply_features(struct webui *w, GtkWidget *view) {
+  unsigned int off = w->disabled_features;
+  if (off == 0) {
+    return;
+  }
+  WebKitSettings *settings = webkit_web_view_get_settings(WEBKIT_WEB_VIEW(view));
+  WebKitWebContext *ctx = webkit_web_view_get_context(WEBKIT_WEB_VIEW(view));
+  if (off & WEBUI_FEATURE_PLUGINS) {
+    G_GNUC_BEGIN_IGNORE_DEPRECATIONS
+    webkit_settings_set_enable_plugins(settings, FALSE);
+    webkit_settings_set_enable_java(settings, FALSE);
+    G_GNUC_END_IGNORE_DEPRECATIONS
+  }
+  /* spell checking and favicons are set on the web context, which all
+   * windows share, so they stay off for every window */
+  if (off & WEBUI_FEATURE_SPELL_CHECKING) {
+    webkit_web_context_set_spell_checking_enabled(ctx, FALSE);
+  }
+  if (off & WEBUI_FEATURE_PAGE_CACHE) {
+    webkit_settings_set_enable_page_cache(settings, FALSE);
+  }
+  if (off & WEBUI_FEATURE_SMOOTH_SCROLLING) {
+    webkit_settings_set_enable_smooth_scrolling(settings, FALSE);
+  }
+  if (off & WEBUI_FEATURE_WEBGL) {
+    webkit_settings_set_enable_webgl(settings, FALSE);
+  }
+  if (off & WEBUI_FEATURE_MEDIA_SOURCE) {
+    webkit_settings_set_enable_mediasource(settings, FALSE);
+  }
+#if WEBKIT_CHECK_VERSION(2, 40, 0)
+  if (off & WEBUI_FEATURE_FAVICONS) {
+    webkit_website_data_manager_set_favicons_enabled(
+        webkit_web_context_get_website_data_manager(ctx), FALSE);
+  }
+#endif
+  if (off & WEBUI_FEATURE_MODAL_DIALOGS) {
+    webkit_settings_set_allow_modal_dialogs(settings, FALSE);
+    g_signal_connect(G_OBJECT(view), "script-dialog",
+                     G_CALLBACK(webui_script_dialog_cb), w);
+  }
+}
+
+static WebKitWebContext *webui_context = NULL;
+
+static guint64 webui_dir_size(const char *path) {
+  guint64 size = 0;
+  GDir *dir = g_dir_open(path, 0, NULL);
+  if (dir == NULL) {
+    return 0;
+  }
+  const char *name;
+  while ((name = g_dir_read_name(dir)) != NULL) {
+    char *child = g_build_filename(path, name, NULL);
+    GStatBuf st;
+    if (g_lstat(child, &st) == 0) {
+      size += S_ISDIR(st.st_mode) ? webui_dir_size(child) : (guint64)st.st_size;
+    }
+    g_free(child);
+  }
+  g_dir_close(dir);
+  return size;
+}
+
+static WebKitWebsiteDataManager *webui_data_manager(struct webui *w) {
+  WebKitWebsiteDataManager *mgr = webkit_website_data_manager_new(
+      "base-data-directory", w->data_dir, "base-cache-directory", w->cache_dir,
+      NULL);
+  /* a startup purge threshold, not a cap: the cache grows freely after */
+  if (w->cache_dir != NULL && w->cache_purge > 0 &&
+      webui_dir_size(w->cache_dir) > (guint64)w->cache_purge << 20) {
+    webkit_website_data_manager_clear(mgr, WEBKIT_WEBSITE_DATA_DISK_CACHE, 0,
+                                      NULL, NULL, NULL);
+  }
+  return mgr;
+}
+
+static WebKitWebContext *webui_web_context_new(struct webui *w) {
+  WebKitWebContext *ctx;
+#if WEBKIT_CHECK_VERSION(2, 34, 0)
+  WebKitMemoryPressureSettings *mem = webkit_memory_pressure_settings_new();
+  if (w->memory_limit > 0) {
+    webkit_memory_pressure_settings_set_memory_limit(mem, w->memory_limit);
+  }
+  if (w->memory_conservative_threshold > 0) {
+    webkit_memory_pressure_settings_set_conservative_threshold(
+        mem, w->memory_conservative_threshold);
+  }
+  if (w->memory_strict_threshold > 0) {
+    webkit_memory_pressure_settings_set_strict_threshold(
+        mem, w->memory_strict_threshold);
+  }
+  if (w->memory_kill_threshold > 0) {
+    webkit_memory_pressure_settings_set_kill_threshold(
+        mem, w->memory_kill_threshold);
+  }
+  /* The network process reads its limits before the first data manager */
+  webkit_website_data_manager_set_memory_pressure_settings(mem);
+  WebKitWebsiteDataManager *mgr = webui_data_manager(w);
+  ctx = WEBKIT_WEB_CONTEXT(
+      g_object_new(WEBKIT_TYPE_WEB_CONTEXT, "website-data-manager", mgr,
+                   "memory-pressure-settings", mem, NULL));
+  webkit_memory_pressure_settings_free(mem);
+#else
+  WebKitWebsiteDataManager *mgr = webui_data_manager(w);
+  ctx = webkit_web_context_new_with_website_data_manager(mgr);
+#endif
+  g_object_unref(mgr);
+  return ctx;
+}
+
+/*
+ * The default context is kept unless a directory or memory pressure
+ * settings are given, those need a context with its own data manager. Its
+ * directories that are not set are left to WebKit, which may place the data
+ * elsewhere than the default context does.
+ */
+static WebKitWebContext *webui_web_context(struct webui *w) {
+  if (webui_context != NULL) {
+    return webui_context;
+  }
+#if WEBKIT_CHECK_VERSION(2, 34, 0)
+  int memory = w->memory_limit != 0 || w->memory_conservative_threshold != 0 ||
+               w->memory_strict_threshold != 0 ||
+               w->memory_kill_threshold != 0;
+#else
+  int memory = 0; /* no memory pressure settings before 2.34 */
+#endif
+  if (w->data_dir == NULL && w->cache_dir == NULL && !memory) {
+    webui_context = webkit_web_context_get_default();
+  } else {
+    webui_context = webui_web_context_new(w);
+  }
+  switch (w->cache_model) {
+  case WEBUI_CACHE_DOCUMENT_VIEWER:
+    webkit_web_context_set_cache_model(webui_context,
+                                       WEBKIT_CACHE_MODEL_DOCUMENT_VIEWER);
+    break;
+  case WEBUI_CACHE_DOCUMENT_BROWSER:
+    webkit_web_context_set_cache_model(webui_context,
+                                       WEBKIT_CACHE_MODEL_DOCUMENT_BROWSER);
+    break;
+  case WEBUI_CACHE_WEB_BROWSER:
+    webkit_web_context_set_cache_model(webui_context,
+                                       WEBKIT_CACHE_MODEL_WEB_BROWSER);
+    break;
+  default:
+    break;
+  }
+  G_GNUC_BEGIN_IGNORE_DEPRECATIONS
+  switch (w->process_model) {
+  case WEBUI_PROCESS_SHARED:
+    webkit_web_context_set_process_model(
+        webui_context, WEBKIT_PROCESS_MODEL_SHARED_SECONDARY_PROCESS);
+    break;
+  case WEBUI_PROCESS_PER_VIEW:
+    webkit_web_context_set_process_model(
+        webui_context, WEBKIT_PROCESS_MODEL_MULTIPLE_SECONDARY_PROCESSES);
+    break;
+  default:
+    break;
+  }
+  G_GNUC_END_IGNORE_DEPRECATIONS
+  return webui_context;
+}
+
+/*
+ * Input latency is measured from the arrival of a press or scroll event at
+ * the view to the page's report that the frame after it was painted, and to
+ * the first window.external.invoke() after it. The UI process frame clock
+ * is not used, its next frame rarely holds the page's response yet. A new
+ * input before either happened restarts the measurement.
+ */
+static gboolean webui_input_event_cb(GtkWidget *widget, GdkEvent *event,
+                                     gpointer arg) {
+  (void)widget;
+  struct webui *w = (struct webui *)arg;
+  switch (event->type) {
+  case GDK_BUTTON_PRESS:
+  case GDK_KEY_PRESS:
+  case GDK_TOUCH_BEGIN:
+  case GDK_SCROLL:
+    webui_stats_add(w->priv.stats.inputs, 1);
+    w->priv.input_paint_pending = g_get_monotonic_time();
+    w->priv.input_handler_pending = w->priv.input_paint_pending;
+    break;
+  default:
+    break;
+  }
+  return FALSE;
+}
+
+static void input_message_received_cb(WebKitUserContentManager *m,
+                                      WebKitJavascriptResult *r,
+                                      gpointer arg) {
+  (void)m;
+  (void)r;
+  struct webui *w = (struct webui *)arg;
+  if (w->priv.input_paint_pending != 0) {
+    webui_stats_record(w->priv.stats.input_paint_latency,
+                       g_get_monotonic_time() - w->priv.input_paint_pending);
+    w->priv.input_paint_pending = 0;
+  }
+}
+
+/*
+ * Visibility follows map/unmap and the iconified/withdrawn window state.
+ * Changes are reported to visibility_cb and to the page as a
+ * 'webui-visibility' event. WebKit already throttles timers and animation
+ * frames of pages in minimized windows; with throttle_hidden the frame
+ * callback is suspended as well and webui_eval() calls are queued until
+ * the window is visible again.
+ */
+static void webui_frame_tick_update(struct webui *w);
+
+static void webui_visibility_update(struct webui *w) {
+  int visible = w->priv.mapped && !w->priv.iconified;
+  int focused = w->priv.focused;
+  if (visible != w->priv.visible) {
+    int64_t now = g_get_monotonic_time();
+    int64_t cpu = webui_cpu_time();
+    struct webui_stats *s = &w->priv.stats;
+    g_mutex_lock(&w->priv.visibility_lock);
+    if (w->priv.visible) {
+      s->visible_time += now - w->priv.visible_since;
+      s->cpu_visible += cpu - w->priv.cpu_since;
+    } else {
+      s->hidden_time += now - w->priv.visible_since;
+      s->cpu_hidden += cpu - w->priv.cpu_since;
+    }
+    w->priv.visible_since = now;
+    w->priv.cpu_since = cpu;
+    w->priv.visible = visible;
+    g_mutex_unlock(&w->priv.visibility_lock);
+    webui_frame_tick_update(w);
+    /* This runs in GTK signal handlers, so the queued scripts are sent
+     * without waiting for them instead of nesting the main loop. WebKit
+     * still runs them in order. */
+    while (visible && !g_queue_is_empty(w->priv.deferred)) {
+      char *js = (char *)g_queue_pop_head(w->priv.deferred);
+      webui_view_run(w->priv.webui, js);
+      webui_stats_add(w->priv.stats.evals, 1);
+      webui_stats_add(w->priv.stats.bytes_to_page, strlen(js));
+      g_free(js);
+    }
+  } else if (w->priv.focused_reported == focused) {
+    return;
+  }
+  w->priv.focused_reported = focused;
+  char js[128];
+  snprintf(js, sizeof(js),
+           "window.dispatchEvent(new CustomEvent('webui-visibility',"
+           "{detail:{visible:%s,focused:%s}}))",
+           visible ? "true" : "false", focused ? "true" : "false");
+  webkit_web_view_run_javascript(WEBKIT_WEB_VIEW(w->priv.webui), js, NULL,
+                                 NULL, NULL);
+  if (w->visibility_cb != NULL) {
+    w->visibility_cb(w, visible, focused);
+  }
+}
+
+static gboolean webui_window_state_cb(GtkWidget *widget,
+                                      GdkEventWindowState *event,
+                                      gpointer arg) {
+  (void)widget;
+  struct webui *w = (struct webui *)arg;
+  w->priv.iconified = (event->new_window_state &
+                       (GDK_WINDOW_STATE_ICONIFIED |
+                        GDK_WINDOW_STATE_WITHDRAWN)) != 0;
+  webui_visibility_update(w);
+  return FALSE;
+}
+
+static gboolean webui_map_event_cb(GtkWidget *widget, GdkEvent *event,
+                                   gpointer arg) {
+  (void)widget;
+  struct webui *w = (struct webui *)arg;
+  w->priv.mapped = event->type == GDK_MAP;
+  webui_visibility_update(w);
+  return FALSE;
+}
+
+static gboolean webui_focus_event_cb(GtkWidget *widget, GdkEventFocus *event,
+                                     gpointer arg) {
+  (void)widget;
+  struct webui *w = (struct webui *)arg;
+  w->priv.focused = event->in != 0;
+  webui_visibility_update(w);
+  return FALSE;
+}
+
+static GtkWidget *webui_view_new(struct webui *w, GtkWidget *related) {
+  GtkWidget *view;
+  if (related != NULL) {
+    /* Screens share the web process, settings and content manager */
+    view = webkit_web_view_new_with_related_view(WEBKIT_WEB_VIEW(related));
+  } else {
+    view = GTK_WIDGET(g_object_new(WEBKIT_TYPE_WEB_VIEW, "web-context",
+                                   webui_web_context(w), "user-content-manager",
+                                   w->priv.content, NULL));
+  }
+  g_signal_connect(G_OBJECT(view), "load-changed",
+                   G_CALLBACK(webui_load_changed_cb), w);
+  g_signal_connect(G_OBJECT(view), "load-failed",
+                   G_CALLBACK(webui_load_failed_cb), w);
+  g_signal_connect(G_OBJECT(view), "web-process-terminated",
+                   G_CALLBACK(webui_web_process_terminated_cb), w);
+#if WEBKIT_CHECK_VERSION(2, 34, 0)
+  g_signal_connect(G_OBJECT(view), "notify::is-web-process-responsive",
+                   G_CALLBACK(webui_responsive_cb), w);
+#else
+  static int hang_warned = 0;
+  if (w->hang_timeout > 0 && !hang_warned) {
+    hang_warned = 1;
+    webui_print_log("webui: hang_timeout needs WebKit 2.34, it is ignored");
+  }
+#endif
+  if (w->input_latency) {
+    g_signal_connect(G_OBJECT(view), "event",
+                     G_CALLBACK(webui_input_event_cb), w);
+  }
+  webui_apply_features(w, view);
+  if (w->debug) {
+    WebKitSettings *settings = webkit_web_view_get_settings(WEBKIT_WEB_VIEW(view));
+    webkit_settings_set_enable_write_console_messages_to_stdout(settings, true);
+    webkit_settings_set_enable_developer_extras(settings, true);
+  } else {
+    g_signal_connect(G_OBJECT(view), "context-menu",
+                     G_CALLBACK(webui_context_menu_cb), w);
+  }
+  return view;
 }
 
 WEBUI_API int webui_init(struct webui *w) {
@@ -252,8 +1440,22 @@ WEBUI_API int webui_init(struct webui *w) {
 
   w->priv.ready = 0;
   w->priv.should_exit = 0;
+  w->priv.id = g_atomic_int_add(&webui_last_id, 1) + 1;
+  memset(&w->priv.startup, 0, sizeof(w->priv.startup));
+  w->priv.startup.init = g_get_monotonic_time();
   w->priv.queue = g_async_queue_new();
-  w->priv.window = gtk_window_new(GTK_WINDOW_TOPLEVEL);
+  w->priv.deferred = g_queue_new();
+  g_mutex_init(&w->priv.visibility_lock);
+  w->priv.visible_since = w->priv.startup.init;
+  w->priv.cpu_since = webui_cpu_time();
+  if (w->offscreen) {
+    /* Rendered into an offscreen surface, for snapshots and headless tests */
+    w->priv.window = gtk_offscreen_window_new();
+  } else {
+    w->priv.window = gtk_window_new(GTK_WINDOW_TOPLEVEL);
+  }
+  /* kept until webui_exit(), also when the window is closed before */
+  g_object_ref(w->priv.window);
   gtk_window_set_title(GTK_WINDOW(w->priv.window), w->title);
 
   switch (w->border){
@@ -274,43 +1476,68 @@ WEBUI_API int webui_init(struct webui *w) {
   if(w->minHeight!=0 || w->minHeight!=0){
     gtk_widget_set_size_request(GTK_WIDGET(w->priv.window),w->minWidth,w->minHeight);
   }
+  if (w->offscreen) {
+    gtk_widget_set_size_request(w->priv.window, w->width, w->height);
+  }
   gtk_window_set_position(GTK_WINDOW(w->priv.window), GTK_WIN_POS_CENTER);
 
   w->priv.scroller = gtk_scrolled_window_new(NULL, NULL);
   gtk_container_add(GTK_CONTAINER(w->priv.window), w->priv.scroller);
 
-  WebKitUserContentManager *m = webkit_user_content_manager_new();
-  webkit_user_content_manager_register_script_message_handler(m, "external");
-  g_signal_connect(m, "script-message-received::external",
+  w->priv.content = webkit_user_content_manager_new();
+  webkit_user_content_manager_register_script_message_handler(w->priv.content,
+                                                              "external");
+  g_signal_connect(w->priv.content, "script-message-received::external",
                    G_CALLBACK(external_message_received_cb), w);
+  webkit_user_content_manager_register_script_message_handler(w->priv.content,
+                                                              "ready");
+  g_signal_connect(w->priv.content, "script-message-received::ready",
+                   G_CALLBACK(ready_message_received_cb), w);
+  webkit_user_content_manager_register_script_message_handler(w->priv.content,
+                                                              "timing");
+  g_signal_connect(w->priv.content, "script-message-received::timing",
+                   G_CALLBACK(timing_message_received_cb), w);
 
-  w->priv.webui = webkit_web_view_new_with_user_content_manager(m);
-  webkit_web_view_load_uri(WEBKIT_WEB_VIEW(w->priv.webui),
-                           webui_check_url(w->url));
-  g_signal_connect(G_OBJECT(w->priv.webui), "load-changed",
-                   G_CALLBACK(webui_load_changed_cb), w);
-  gtk_container_add(GTK_CONTAINER(w->priv.scroller), w->priv.webui);
+  webui_add_user_script(w, WEBUI_EXTERNAL_JS);
+  if (w->input_latency) {
+    webkit_user_content_manager_register_script_message_handler(
+        w->priv.content, "input");
+    g_signal_connect(w->priv.content, "script-message-received::input",
+                     G_CALLBACK(input_message_received_cb), w);
+    webui_add_user_script(w, WEBUI_INPUT_JS);
+  }
 
-  if (w->debug) {
-    WebKitSettings *settings =
-        webkit_web_view_get_settings(WEBKIT_WEB_VIEW(w->priv.webui));
-    webkit_settings_set_enable_write_console_messages_to_stdout(settings, true);
-    webkit_settings_set_enable_developer_extras(settings, true);
+  w->priv.webui = webui_view_new(w, NULL);
+  if (w->html != NULL) {
+    webui_load_html(w, w->html, w->html_len, w->base_uri);
   } else {
-    g_signal_connect(G_OBJECT(w->priv.webui), "context-menu",
-                     G_CALLBACK(webui_context_menu_cb), w);
+    webkit_web_view_load_uri(WEBKIT_WEB_VIEW(w->priv.webui),
+                             webui_check_url(w->url));
   }
+  gtk_container_add(GTK_CONTAINER(w->priv.scroller), w->priv.webui);
 
-  gtk_widget_show_all(w->priv.window);
-
-  webkit_web_view_run_javascript(
-      WEBKIT_WEB_VIEW(w->priv.webui),
-      "window.external={invoke:function(x){"
-      "window.webkit.messageHandlers.external.postMessage(x);}}",
-      NULL, NULL, NULL);
+  if (w->show_mode == WEBUI_SHOW_IMMEDIATE) {
+    gtk_widget_show_all(w->priv.window);
+    w->priv.startup.shown = g_get_monotonic_time();
+  } else {
+    /* Keep the window hidden until the page has something to show */
+    gtk_widget_show_all(w->priv.scroller);
+    w->priv.show_timer = g_timeout_add(
+        w->show_timeout > 0 ? w->show_timeout : 3000, webui_show_timeout_cb, w);
+  }
 
   g_signal_connect(G_OBJECT(w->priv.window), "destroy",
                    G_CALLBACK(webui_destroy_cb), w);
+  g_signal_connect(G_OBJECT(w->priv.window), "window-state-event",
+                   G_CALLBACK(webui_window_state_cb), w);
+  g_signal_connect(G_OBJECT(w->priv.window), "map-event",
+                   G_CALLBACK(webui_map_event_cb), w);
+  g_signal_connect(G_OBJECT(w->priv.window), "unmap-event",
+                   G_CALLBACK(webui_map_event_cb), w);
+  g_signal_connect(G_OBJECT(w->priv.window), "focus-in-event",
+                   G_CALLBACK(webui_focus_event_cb), w);
+  g_signal_connect(G_OBJECT(w->priv.window), "focus-out-event",
+                   G_CALLBACK(webui_focus_event_cb), w);
   g_signal_connect(G_OBJECT(w->priv.window), "delete-event",
                    G_CALLBACK(webui_delete_event_cb), w);
                    
@@ -326,6 +1553,117 @@ WEBUI_API void webui_set_title(struct webui *w, const char *title) {
   gtk_window_set_title(GTK_WINDOW(w->priv.window), title);
 }
 
+WEBUI_API void webui_set_title_n(struct webui *w, const char *title,
+                                 size_t len) {
+  char buf[256];
+  char *s = len < sizeof(buf) ? buf : (char *)g_malloc(len + 1);
+  memcpy(s, title, len);
+  s[len] = '\0';
+  gtk_window_set_title(GTK_WINDOW(w->priv.window), s);
+  if (s != buf) {
+    g_free(s);
+  }
+}
+
+static struct webui_screen *webui_screen_find(struct webui *w,
+                                              const char *url) {
+  for (int i = 0; i < WEBUI_SCREEN_CACHE; i++) {
+    struct webui_screen *s = &w->priv.screens[i];
+    if (s->view != NULL && strcmp(s->url, url) == 0) {
+      return s;
+    }
+  }
+  return NULL;
+}
+
+static void webui_screen_release(struct webui_screen *s) {
+  if (s->view != NULL) {
+    gtk_widget_destroy(s->view);
+    g_object_unref(s->view);
+  }
+  g_free(s->url);
+  s->url = NULL;
+  s->view = NULL;
+  s->committed = 0;
+}
+
+WEBUI_API void webui_prerender(struct webui *w, const char *url) {
+  url = webui_check_url(url);
+  struct webui_screen *s = webui_screen_find(w, url);
+  if (s != NULL) {
+    s->used = ++w->priv.screen_clock;
+    return;
+  }
+  /* Evict the least recently used screen */
+  s = &w->priv.screens[0];
+  for (int i = 1; i < WEBUI_SCREEN_CACHE && s->view != NULL; i++) {
+    struct webui_screen *c = &w->priv.screens[i];
+    if (c->view == NULL || c->used < s->used) {
+      s = c;
+    }
+  }
+  webui_screen_release(s);
+  s->view = webui_view_new(w, w->priv.webui);
+  g_object_ref_sink(s->view);
+  s->url = g_strdup(url);
+  s->used = ++w->priv.screen_clock;
+  webkit_web_view_load_uri(WEBKIT_WEB_VIEW(s->view), url);
+}
+
+/*
+ * The HTML is handed to WebKit as is, unlike a data: URL it needs no
+ * encoding and has no size limit. A base URI on a custom scheme lets the
+ * page load its assets through the scheme handler.
+ */
+WEBUI_API void webui_load_html(struct webui *w, const char *html, size_t len,
+                               const char *base_uri) {
+  GBytes *bytes = g_bytes_new(html, len);
+  webkit_web_view_load_bytes(WEBKIT_WEB_VIEW(w->priv.webui), bytes,
+                             "text/html", "UTF-8", base_uri);
+  g_bytes_unref(bytes);
+}
+
+WEBUI_API void webui_navigate(struct webui *w, const char *url) {
+  url = webui_check_url(url);
+  struct webui_screen *s = webui_screen_find(w, url);
+  if (s == NULL) {
+    webui_prerender(w, url);
+    s = webui_screen_find(w, url);
+  }
+  /* Swap the screen in and keep the current page alive in its slot */
+  GtkWidget *view = s->view;
+  GtkWidget *old = w->priv.webui;
+  const char *uri = webkit_web_view_get_uri(WEBKIT_WEB_VIEW(old));
+  g_object_ref(old);
+  gtk_container_remove(GTK_CONTAINER(w->priv.scroller), old);
+  gtk_container_add(GTK_CONTAINER(w->priv.scroller), view);
+  gtk_widget_show(view);
+  g_object_unref(view);
+  g_free(s->url);
+  s->url = g_strdup(uri != NULL ? uri : "");
+  s->view = old;
+  s->used = ++w->priv.screen_clock;
+  int committed = s->committed;
+  s->committed = w->priv.committed;
+  w->priv.webui = view;
+  w->priv.ready = !webkit_web_view_is_loading(WEBKIT_WEB_VIEW(view));
+  w->priv.committed = committed || w->priv.ready;
+  /* the load span of the old view does not apply to the new one */
+  w->priv.load_started = 0;
+}
+
+WEBUI_API void webui_ready(struct webui *w) {
+  if (w->priv.startup.ready == 0) {
+    w->priv.startup.ready = g_get_monotonic_time();
+  }
+  webui_show(w);
+}
+
+WEBUI_API void webui_get_startup(struct webui *w,
+                                 struct webui_startup *startup) {
+  *startup = w->priv.startup;
+}
+
 WEBUI_API void webui_set_fullscreen(struct webui *w, int fullscreen) {
   if (fullscreen) {
     gtk_window_fullscreen(GTK_WINDOW(w->priv.window));
@@ -341,6 +1679,12 @@ WEBUI_API void webui_set_color(struct webui *w, uint8_t r, uint8_t g,
                                        &color);
 }
 WEBUI_API int webui_msg(struct webui *w,enum webui_msg_type flag,const char *title,const char *msg){
+  return webui_msg_n(w, flag, title, strlen(title), msg, strlen(msg));
+}
+
+WEBUI_API int webui_msg_n(struct webui *w, enum webui_msg_type flag,
+                          const char *title, size_t title_len, const char *msg,
+                          size_t msg_len) {
   GtkWidget *dlg;
   GtkMessageType type = GTK_MESSAGE_OTHER;
   switch (flag & WEBUI_MSG_ICON_MASK){
@@ -357,8 +1701,10 @@ WEBUI_API int webui_msg(struct webui *w,enum webui_msg_type flag,const char *tit
     break;
   }
   dlg = gtk_message_dialog_new(GTK_WINDOW(w->priv.window), GTK_DIALOG_MODAL,
-                                 type, GTK_BUTTONS_NONE, "%s", title);
-  gtk_message_dialog_format_secondary_text(GTK_MESSAGE_DIALOG(dlg), "%s",msg);
+                                 type, GTK_BUTTONS_NONE, "%.*s",
+                                 (int)title_len, title);
+  gtk_message_dialog_format_secondary_text(GTK_MESSAGE_DIALOG(dlg), "%.*s",
+                                           (int)msg_len, msg);
   switch (flag & WEBUI_MSG_BUTTON_MASK){
   case WEBUI_MSG_OK_CANCEL:
     gtk_dialog_add_button(GTK_DIALOG(dlg),"Ok",WEBUI_RESPONSE_OK);
@@ -450,27 +1796,355 @@ WEBUI_API void webui_file(struct webui *w,enum webui_file_type flag,const char *
   gtk_widget_destroy(dlg);
 } 
 
+static void webui_eval_done(struct webui *w, const char *name, int64_t ts,
+                            size_t n) {
+  webui_stats_add(w->priv.stats.evals_in_flight, -1);
+  webui_stats_add(w->priv.stats.evals, 1);
+  webui_stats_add(w->priv.stats.bytes_to_page, n);
+  webui_stats_record(w->priv.stats.eval_latency, g_get_monotonic_time() - ts);
+  webui_trace_end(w, "ipc", name, ts, n);
+}
+
+/*
+ * Evals wait for the page and then for the result in a nested main loop, up
+ * to eval_timeout ms. The call state lives on the heap so that an eval that
+ * was given up on (timeout, cancel, web process gone) can still be completed by
+ * WebKit later; the late callback then only frees it.
+ */
+struct webui_eval_call {
+  int done;
+  int abandoned;
+  int want_result;
+  int status;
+  char *result;
+};
+
 static void webui_eval_finished(GObject *object, GAsyncResult *result,
-                                  gpointer userdata) {
-  (void)object;
-  (void)result;
-  struct webui *w = (struct webui *)userdata;
-  w->priv.js_busy = 0;
+                                gpointer userdata) {
+  struct webui_eval_call *call = (struct webui_eval_call *)userdata;
+  GError *err = NULL;
+#if WEBKIT_CHECK_VERSION(2, 40, 0)
+  JSCValue *value = webkit_web_view_evaluate_javascript_finish(
+      WEBKIT_WEB_VIEW(object), result, &err);
+#else
+  WebKitJavascriptResult *r = webkit_web_view_run_javascript_finish(
+      WEBKIT_WEB_VIEW(object), result, &err);
+  JSCValue *value = r != NULL ? webkit_javascript_result_get_js_value(r) : NULL;
+#endif
+  if (call->abandoned) {
+    g_free(call);
+  } else if (value == NULL) {
+    call->status = -1;
+    if (call->want_result) {
+      call->result = strdup(err != NULL ? err->message : "evaluation failed");
+    }
+    call->done = 1;
+  } else {
+    if (call->want_result) {
+      char *json = NULL;
+      if (!jsc_value_is_undefined(value)) {
+        json = jsc_value_to_json(value, 0);
+      }
+      call->result = strdup(json != NULL ? json : "null");
+      g_free(json);
+    }
+    call->done = 1;
+  }
+  g_clear_error(&err);
+#if WEBKIT_CHECK_VERSION(2, 40, 0)
+  g_clear_object(&value);
+#else
+  if (r != NULL) {
+    webkit_javascript_result_unref(r);
+  }
+#endif
 }
 
-WEBUI_API int webui_eval(struct webui *w, const char *js) {
-  while (w->priv.ready == 0) {
+static gboolean webui_expired_cb(gpointer arg) {
+  *(int *)arg = 1;
+  return G_SOURCE_REMOVE;
+}
+
+static int webui_eval_cancelled(struct webui_cancel *cancel) {
+  return cancel != NULL && g_atomic_int_get(&cancel->cancelled);
+}
+
+/* returns 0, -1 when the script failed or the web process went away, -2 on
+ * timeout and -3 when cancel was cancelled, result gets the JSON
+ * value or the error message. timeout is in ms, 0 waits as long as it takes */
+static int webui_eval_call(struct webui *w, const char *js, gssize len,
+                           int timeout, struct webui_cancel *cancel,
+                           const char *name, char **result) {
+  int64_t ts = g_get_monotonic_time();
+  size_t size = len < 0 ? strlen(js) : (size_t)len;
+  char *copy = NULL;
+  int expired = 0;
+  int started = 0;
+  int cancelled = 0;
+  guint timer = 0;
+  GCancellable *cancellable = NULL;
+  if (w->priv.ready == 0) {
+    /* a borrowed script is only valid until the main loop runs */
+    js = copy = g_strndup(js, size);
+    len = -1;
+  }
+  struct webui_eval_call *call = g_new0(struct webui_eval_call, 1);
+  call->want_result = result != NULL;
+  webui_stats_add(w->priv.stats.evals_in_flight, 1);
+  if (timeout > 0) {
+    timer = g_timeout_add(timeout, webui_expired_cb, &expired);
+  }
+  while (w->priv.ready == 0 && !expired &&
+         !(cancelled = webui_eval_cancelled(cancel))) {
     g_main_context_iteration(NULL, TRUE);
   }
-  w->priv.js_busy = 1;
-  webkit_web_view_run_javascript(WEBKIT_WEB_VIEW(w->priv.webui), js, NULL,
-                                 webui_eval_finished, w);
-  while (w->priv.js_busy) {
+  if (!expired && !cancelled) {
+    unsigned int generation = w->priv.generation;
+    started = 1;
+    cancellable = g_cancellable_new();
+#if WEBKIT_CHECK_VERSION(2, 40, 0)
+    webkit_web_view_evaluate_javascript(WEBKIT_WEB_VIEW(w->priv.webui), js,
+                                        len, NULL, NULL, cancellable,
+                                        webui_eval_finished, call);
+#else
+    if (len >= 0) {
+      w->priv.script.len = 0;
+      if (webui_buf_append(&w->priv.script, js, size) != 0) {
+        call->status = -1;
+        call->done = 1;
+      }
+      js = w->priv.script.data;
+    }
+    if (!call->done) {
+      webkit_web_view_run_javascript(WEBKIT_WEB_VIEW(w->priv.webui), js,
+                                     cancellable, webui_eval_finished, call);
+    }
+#endif
+    while (!call->done && !expired && generation == w->priv.generation &&
+           !(cancelled = webui_eval_cancelled(cancel))) {
+      g_main_context_iteration(NULL, TRUE);
+    }
+  }
+  if (timer != 0 && !expired) {
+    g_source_remove(timer);
+  }
+  int status;
+  if (call->done) {
+    status = call->status;
+    if (result != NULL) {
+      *result = call->result;
+    }
+    g_free(call);
+  } else {
+    if (expired) {
+      status = -2;
+      webui_stats_add(w->priv.stats.eval_timeouts, 1);
+    } else if (cancelled) {
+      status = -3;
+      webui_stats_add(w->priv.stats.eval_cancels, 1);
+    } else {
+      status = -1;
+    }
+    if (result != NULL) {
+      *result = strdup(status == -2   ? "evaluation timed out"
+                       : status == -3 ? "evaluation cancelled"
+                                      : "web process terminated");
+    }
+    if (started) {
+      /* WebKit drops the request and completes it with an error */
+      call->abandoned = 1;
+      g_cancellable_cancel(cancellable);
+    } else {
+      g_free(call);
+    }
+  }
+  if (cancellable != NULL) {
+    g_object_unref(cancellable);
+  }
+  g_free(copy);
+  webui_eval_done(w, name, ts, size);
+  return status;
+}
+
+static int webui_eval_len(struct webui *w, const char *js, gssize len) {
+  if (w->throttle_hidden && !w->priv.visible && w->priv.startup.shown != 0) {
+    g_queue_push_tail(w->priv.deferred,
+                      len < 0 ? g_strdup(js) : g_strndup(js, len));
+    webui_stats_add(w->priv.stats.deferred_evals, 1);
+    return 0;
+  }
+  return webui_eval_call(w, js, len, w->eval_timeout, NULL, "eval", NULL);
+}
+
+WEBUI_API int webui_eval(struct webui *w, const char *js) {
+  return webui_eval_len(w, js, -1);
+}
+
+/* js needs no trailing zero and is not used after the call returns */
+WEBUI_API int webui_eval_n(struct webui *w, const char *js, size_t len) {
+  return webui_eval_len(w, js, (gssize)len);
+}
+
+/*
+ * Hands the script to the web process and returns without running the main
+ * loop, so it can be called from a frame callback. Errors in the script are
+ * not reported. Returns -1 without sending it while the page is not ready.
+ */
+WEBUI_API int webui_eval_async(struct webui *w, const char *js, size_t len) {
+  if (w->priv.ready == 0) {
+    return -1;
+  }
+  int64_t ts = g_get_monotonic_time();
+#if WEBKIT_CHECK_VERSION(2, 40, 0)
+  webkit_web_view_evaluate_javascript(WEBKIT_WEB_VIEW(w->priv.webui), js,
+                                      (gssize)len, NULL, NULL, NULL, NULL,
+                                      NULL);
+#else
+  w->priv.script.len = 0;
+  if (webui_buf_append(&w->priv.script, js, len) != 0) {
+    return -1;
+  }
+  webkit_web_view_run_javascript(WEBKIT_WEB_VIEW(w->priv.webui),
+                                 w->priv.script.data, NULL, NULL, NULL);
+#endif
+  webui_stats_add(w->priv.stats.evals, 1);
+  webui_stats_add(w->priv.stats.bytes_to_page, len);
+  webui_trace_end(w, "ipc", "eval_async", ts, len);
+  return 0;
+}
+
+WEBUI_API int webui_eval_result(struct webui *w, const char *js,
+                                char **result) {
+  *result = NULL;
+  return webui_eval_call(w, js, -1, w->eval_timeout, NULL,
+                         "eval_result", result);
+}
+
+WEBUI_API int webui_eval_result_n(struct webui *w, const char *js, size_t len,
+                                  char **result) {
+  *result = NULL;
+  return webui_eval_call(w, js, (gssize)len, w->eval_timeout, NULL,
+                         "eval_result", result);
+}
+
+/*
+ * Like webui_eval_result_n() with its own timeout in ms instead of
+ * eval_timeout, 0 waits until the script completes or cancel is cancelled.
+ * cancel and result may be NULL. The script runs even while the window is
+ * hidden.
+ */
+WEBUI_API int webui_eval_timeout(struct webui *w, const char *js, size_t len,
+                                 int timeout, struct webui_cancel *cancel,
+                                 char **result) {
+  if (result != NULL) {
+    *result = NULL;
+  }
+  return webui_eval_call(w, js, (gssize)len, timeout, cancel, "eval", result);
+}
+
+/* Can be called from any thread. Only the evals given this cancel return,
+ * with -3, other evals waiting in the same nested loops go on. */
+WEBUI_API void webui_eval_cancel(struct webui_cancel *cancel) {
+  g_atomic_int_set(&cancel->cancelled, 1);
+  g_main_context_wakeup(NULL);
+}
+
+WEBUI_API int webui_wait_ready(struct webui *w, int timeout) {
+  int expired = 0;
+  guint timer = 0;
+  if (timeout > 0) {
+    timer = g_timeout_add(timeout, webui_expired_cb, &expired);
+  }
+  while (w->priv.ready == 0 && !expired) {
     g_main_context_iteration(NULL, TRUE);
   }
+  if (timer != 0 && !expired) {
+    g_source_remove(timer);
+  }
+  return w->priv.ready ? 0 : -1;
+}
+
+WEBUI_API int webui_iterate(int blocking) {
+  return g_main_context_iteration(NULL, blocking);
+}
+
+WEBUI_API void webui_wakeup(void) { g_main_context_wakeup(NULL); }
+
+/*
+ * Page marks and measures are read with their start relative to the page's
+ * time origin, next to the current performance.now(). That instant is
+ * taken to be the middle of the round trip to map them onto our clock.
+ */
+#define WEBUI_TRACE_PAGE_JS                                                    \
+  "(function(){var p=window.performance,r=[p.now()];"                          \
+  "p.getEntriesByType('mark').concat(p.getEntriesByType('measure'))"           \
+  ".forEach(function(e){r.push(e.startTime+','+e.duration+','+"                \
+  "encodeURIComponent(e.entryType+':'+e.name));});"                            \
+  "p.clearMarks();p.clearMeasures();return r.join('|');})()"
+
+WEBUI_API int webui_trace_collect_page(struct webui *w) {
+  char *result = NULL;
+  int64_t sent = g_get_monotonic_time();
+  if (webui_eval_result(w, WEBUI_TRACE_PAGE_JS, &result) != 0) {
+    free(result);
+    return -1;
+  }
+  int64_t now = sent + (g_get_monotonic_time() - sent) / 2;
+  /* the result is a JSON string without escapes, strip the quotes */
+  size_t n = strlen(result);
+  if (n < 2) {
+    free(result);
+    return -1;
+  }
+  result[n - 1] = '\0';
+  gchar **entries = g_strsplit(result + 1, "|", -1);
+  double page_now = g_ascii_strtod(entries[0], NULL);
+  for (int i = 1; entries[0] != NULL && entries[i] != NULL; i++) {
+    gchar **f = g_strsplit(entries[i], ",", 3);
+    if (f[0] != NULL && f[1] != NULL && f[2] != NULL) {
+      double start = g_ascii_strtod(f[0], NULL);
+      double dur = g_ascii_strtod(f[1], NULL);
+      char *name = g_uri_unescape_string(f[2], NULL);
+      webui_trace_add(w, "page", name != NULL ? name : f[2],
+                      now - (int64_t)((page_now - start) * 1000),
+                      (int64_t)(dur * 1000), 0);
+      g_free(name);
+    }
+    g_strfreev(f);
+  }
+  g_strfreev(entries);
+  free(result);
   return 0;
 }
 
+static gboolean webui_frame_tick_cb(GtkWidget *widget, GdkFrameClock *clock,
+                                    gpointer arg) {
+  (void)widget;
+  struct webui *w = (struct webui *)arg;
+  if (w->priv.frame_cb != NULL) {
+    w->priv.frame_cb(w, gdk_frame_clock_get_frame_time(clock),
+                     gdk_frame_clock_get_frame_counter(clock));
+  }
+  return G_SOURCE_CONTINUE;
+}
+
+static void webui_frame_tick_update(struct webui *w) {
+  int run = w->priv.frame_cb != NULL &&
+            (w->priv.visible || !w->throttle_hidden);
+  if (run && w->priv.frame_tick == 0) {
+    w->priv.frame_tick = gtk_widget_add_tick_callback(
+        w->priv.window, webui_frame_tick_cb, w, NULL);
+  } else if (!run && w->priv.frame_tick != 0) {
+    gtk_widget_remove_tick_callback(w->priv.window, w->priv.frame_tick);
+    w->priv.frame_tick = 0;
+  }
+}
+
+WEBUI_API void webui_on_frame(struct webui *w, webui_frame_cb cb) {
+  w->priv.frame_cb = cb;
+  webui_frame_tick_update(w);
+}
+
 static gboolean webui_dispatch_wrapper(gpointer userdata) {
   struct webui *w = (struct webui *)userdata;
   for (;;) {
@@ -479,7 +2153,11 @@ static gboolean webui_dispatch_wrapper(gpointer userdata) {
     if (arg == NULL) {
       break;
     }
+    int64_t ts = g_get_monotonic_time();
+    webui_stats_record(w->priv.stats.dispatch_latency, ts - arg->queued);
     (arg->fn)(w, arg->arg);
+    webui_stats_add(w->priv.stats.dispatches, 1);
+    webui_trace_end(w, "ipc", "dispatch", ts, 0);
     g_free(arg);
   }
   return FALSE;
@@ -492,23 +2170,414 @@ WEBUI_API void webui_dispatch(struct webui *w, webui_dispatch_fn fn,
   context->w = w;
   context->arg = arg;
   context->fn = fn;
+  context->queued = g_get_monotonic_time();
   g_async_queue_lock(w->priv.queue);
   g_async_queue_push_unlocked(w->priv.queue, context);
   if (g_async_queue_length_unlocked(w->priv.queue) == 1) {
-    gdk_threads_add_idle(webui_dispatch_wrapper, w);
+    /* w is the user data of the source, webui_exit() removes it by that */
+    g_idle_add(webui_dispatch_wrapper, w);
   }
   g_async_queue_unlock(w->priv.queue);
 }
 
+/*
+ * Surfaces stream RGBA frames into a <canvas>. Native code draws into the
+ * back buffer and commits it, which makes it the front buffer. The page
+ * long-polls webui-surface://<id>/next and gets the front buffer handed
+ * over without a copy; a commit while the front buffer is still being sent
+ * is dropped. Requests are served on the main thread, so surfaces are only
+ * drawn, committed and freed there as well, other threads go through
+ * webui_dispatch().
+ */
+#define WEBUI_SURFACE_SCHEME "webui-surface"
+
+#define WEBUI_SURFACE_JS                                                       \
+  "(function(id,canvas,w,h){function start(){"                                 \
+  "var c=document.getElementById(canvas);if(!c){return;}"                      \
+  "c.width=w;c.height=h;var ctx=c.getContext('2d');"                           \
+  "var img=ctx.createImageData(w,h);function next(){"                          \
+  "fetch('" WEBUI_SURFACE_SCHEME "://'+id+'/next').then(function(r){"         \
+  "if(!r.ok){throw r.status;}return r.arrayBuffer();}).then(function(b){"      \
+  "img.data.set(new Uint8ClampedArray(b));ctx.putImageData(img,0,0);next();"  \
+  "}).catch(function(){});}next();}if(document.readyState==='loading'){"       \
+  "document.addEventListener('DOMContentLoaded',start);}else{start();}})"
+
+struct webui_surface {
+  struct webui *w;
+  int id;
+  int width;
+  int height;
+  size_t size;
+  uint8_t *buf[2];
+  int back;
+  int front_busy;
+  int front_fresh;
+  int closed;
+  int64_t front_time;
+  int64_t latency_total;
+  WebKitURISchemeRequest *pending;
+  WebKitUserScript *script; /* starts the stream on every page load */
+  struct webui_surface_stats stats;
+};
+
+static GHashTable *webui_surfaces = NULL;
+static int webui_surface_last_id = 0;
+
+static void webui_surface_destroy(struct webui_surface *s) {
+  g_free(s->buf[0]);
+  g_free(s->buf[1]);
+  g_free(s);
+}
+
+static void webui_surface_sent(gpointer arg) {
+  struct webui_surface *s = (struct webui_surface *)arg;
+  int64_t latency = g_get_monotonic_time() - s->front_time;
+  s->stats.presented++;
+  s->stats.latency_last = latency;
+  s->latency_total += latency;
+  s->stats.latency_avg = s->latency_total / (int64_t)s->stats.presented;
+  if (latency > s->stats.latency_max) {
+    s->stats.latency_max = latency;
+  }
+  s->front_busy = 0;
+  if (s->closed) {
+    webui_surface_destroy(s);
+  }
+}
+
+static void webui_surface_serve(struct webui_surface *s) {
+  WebKitURISchemeRequest *request = s->pending;
+  s->pending = NULL;
+  s->front_fresh = 0;
+  s->front_busy = 1;
+  GBytes *bytes = g_bytes_new_with_free_func(s->buf[1 - s->back], s->size,
+                                             webui_surface_sent, s);
+  GInputStream *stream = g_memory_input_stream_new_from_bytes(bytes);
+  webkit_uri_scheme_request_finish(request, stream, s->size,
+                                   "application/octet-stream");
+  g_object_unref(stream);
+  g_bytes_unref(bytes);
+  g_object_unref(request);
+}
+
+static void webui_surface_scheme_cb(WebKitURISchemeRequest *request,
+                                    gpointer arg) {
+  (void)arg;
+  int id = 0;
+  struct webui_surface *s = NULL;
+  if (sscanf(webkit_uri_scheme_request_get_uri(request),
+             WEBUI_SURFACE_SCHEME "://%d/", &id) == 1) {
+    s = (struct webui_surface *)g_hash_table_lookup(webui_surfaces,
+                                                    GINT_TO_POINTER(id));
+  }
+  if (s == NULL) {
+    GError *err =
+        g_error_new_literal(G_IO_ERROR, G_IO_ERROR_NOT_FOUND, "no surface");
+    webkit_uri_scheme_request_finish_error(request, err);
+    g_error_free(err);
+    return;
+  }
+  if (s->pending != NULL) {
+    /* a reloaded page polls again, the old fetch must still settle */
+    GError *err = g_error_new_literal(G_IO_ERROR, G_IO_ERROR_CANCELLED,
+                                      "superseded");
+    webkit_uri_scheme_request_finish_error(s->pending, err);
+    g_error_free(err);
+    g_object_unref(s->pending);
+  }
+  s->pending = WEBKIT_URI_SCHEME_REQUEST(g_object_ref(request));
+  if (s->front_fresh && !s->front_busy) {
+    webui_surface_serve(s);
+  }
+}
+
+WEBUI_API struct webui_surface *webui_surface_new(struct webui *w,
+                                                  const char *canvas,
+                                                  int width, int height) {
+  if (width <= 0 || height <= 0) {
+    return NULL;
+  }
+  if (webui_surfaces == NULL) {
+    WebKitWebContext *ctx =
+        webkit_web_view_get_context(WEBKIT_WEB_VIEW(w->priv.webui));
+    webkit_web_context_register_uri_scheme(ctx, WEBUI_SURFACE_SCHEME,
+                                           webui_surface_scheme_cb, NULL, NULL);
+    WebKitSecurityManager *sm = webkit_web_context_get_security_manager(ctx);
+    webkit_security_manager_register_uri_scheme_as_cors_enabled(
+        sm, WEBUI_SURFACE_SCHEME);
+    webkit_security_manager_register_uri_scheme_as_secure(sm,
+                                                          WEBUI_SURFACE_SCHEME);
+    webui_surfaces = g_hash_table_new(g_direct_hash, g_direct_equal);
+  }
+  struct webui_surface *s = g_new0(struct webui_surface, 1);
+  s->w = w;
+  s->id = ++webui_surface_last_id;
+  s->width = width;
+  s->height = height;
+  s->size = (size_t)width * height * 4;
+  s->buf[0] = (uint8_t *)g_malloc0(s->size);
+  s->buf[1] = (uint8_t *)g_malloc0(s->size);
+  g_hash_table_insert(webui_surfaces, GINT_TO_POINTER(s->id), s);
+
+  struct webui_buf id = {NULL, 0, 0};
+  webui_buf_append_js(&id, canvas, strlen(canvas));
+  char *js = g_strdup_printf("%s(%d,\"%s\",%d,%d)", WEBUI_SURFACE_JS, s->id,
+                             id.data != NULL ? id.data : "", width, height);
+  s->script = webui_user_script_new(w, js);
+  g_free(js);
+  free(id.data);
+  return s;
+}
+
+WEBUI_API uint8_t *webui_surface_pixels(struct webui_surface *s) {
+  return s->buf[s->back];
+}
+
+WEBUI_API int webui_surface_commit(struct webui_surface *s) {
+  s->stats.committed++;
+  if (s->front_busy) {
+    s->stats.dropped++;
+    return -1;
+  }
+  if (s->front_fresh) {
+    /* the page never fetched the previous frame */
+    s->stats.dropped++;
+  }
+  s->back = 1 - s->back;
+  s->front_fresh = 1;
+  s->front_time = g_get_monotonic_time();
+  if (s->pending != NULL) {
+    webui_surface_serve(s);
+  }
+  return 0;
+}
+
+WEBUI_API void webui_surface_stats(struct webui_surface *s,
+                                   struct webui_surface_stats *stats) {
+  *stats = s->stats;
+}
+
+WEBUI_API void webui_surface_free(struct webui_surface *s) {
+  g_hash_table_remove(webui_surfaces, GINT_TO_POINTER(s->id));
+  if (s->pending != NULL) {
+    GError *err =
+        g_error_new_literal(G_IO_ERROR, G_IO_ERROR_CLOSED, "surface closed");
+    webkit_uri_scheme_request_finish_error(s->pending, err);
+    g_error_free(err);
+    g_object_unref(s->pending);
+    s->pending = NULL;
+  }
+  /* Before WebKit 2.32 the script stays, it stops at the first failed fetch */
+#if WEBKIT_CHECK_VERSION(2, 32, 0)
+  if (s->w->priv.content != NULL) {
+    webkit_user_content_manager_remove_script(s->w->priv.content, s->script);
+  }
+#endif
+  webkit_user_script_unref(s->script);
+  s->script = NULL;
+  s->closed = 1;
+  if (!s->front_busy) {
+    webui_surface_destroy(s);
+  }
+}
+
+struct webui_snapshot_call {
+  int done;
+  cairo_surface_t *surface;
+};
+
+static void webui_snapshot_finished(GObject *object, GAsyncResult *result,
+                                    gpointer userdata) {
+  struct webui_snapshot_call *call = (struct webui_snapshot_call *)userdata;
+  call->surface = webkit_web_view_get_snapshot_finish(WEBKIT_WEB_VIEW(object),
+                                                      result, NULL);
+  call->done = 1;
+}
+
+static cairo_status_t webui_snapshot_write_png(void *closure,
+                                               const unsigned char *data,
+                                               unsigned int length) {
+  g_byte_array_append((GByteArray *)closure, data, length);
+  return CAIRO_STATUS_SUCCESS;
+}
+
+WEBUI_API int webui_snapshot(struct webui *w, int format, int full_document,
+                             uint8_t **data, size_t *len, int *width,
+                             int *height) {
+  struct webui_snapshot_call call = {0, NULL};
+  *data = NULL;
+  *len = 0;
+  while (w->priv.ready == 0) {
+    g_main_context_iteration(NULL, TRUE);
+  }
+  webkit_web_view_get_snapshot(
+      WEBKIT_WEB_VIEW(w->priv.webui),
+      full_document ? WEBKIT_SNAPSHOT_REGION_FULL_DOCUMENT
+                    : WEBKIT_SNAPSHOT_REGION_VISIBLE,
+      WEBKIT_SNAPSHOT_OPTIONS_NONE, NULL, webui_snapshot_finished, &call);
+  while (!call.done) {
+    g_main_context_iteration(NULL, TRUE);
+  }
+  if (call.surface == NULL) {
+    return -1;
+  }
+  cairo_surface_flush(call.surface);
+  int sw = cairo_image_surface_get_width(call.surface);
+  int sh = cairo_image_surface_get_height(call.surface);
+  if (width != NULL) {
+    *width = sw;
+  }
+  if (height != NULL) {
+    *height = sh;
+  }
+  if (format == WEBUI_SNAPSHOT_PNG) {
+    GByteArray *png = g_byte_array_new();
+    cairo_surface_write_to_png_stream(call.surface, webui_snapshot_write_png,
+                                      png);
+    *len = png->len;
+    *data = (uint8_t *)malloc(png->len);
+    if (*data != NULL) {
+      memcpy(*data, png->data, png->len);
+    }
+    g_byte_array_free(png, TRUE);
+  } else {
+    /* cairo keeps premultiplied native endian ARGB, convert to RGBA */
+    int stride = cairo_image_surface_get_stride(call.surface);
+    const uint8_t *src = cairo_image_surface_get_data(call.surface);
+    *len = (size_t)sw * sh * 4;
+    *data = (uint8_t *)malloc(*len);
+    for (int y = 0; *data != NULL && y < sh; y++) {
+      const uint32_t *row = (const uint32_t *)(src + (size_t)y * stride);
+      uint8_t *out = *data + (size_t)y * sw * 4;
+      for (int x = 0; x < sw; x++, out += 4) {
+        uint32_t p = row[x];
+        uint32_t a = p >> 24;
+        out[3] = (uint8_t)a;
+        if (a == 0) {
+          out[0] = out[1] = out[2] = 0;
+          continue;
+        }
+        out[0] = (uint8_t)((((p >> 16) & 0xff) * 255 + a / 2) / a);
+        out[1] = (uint8_t)((((p >> 8) & 0xff) * 255 + a / 2) / a);
+        out[2] = (uint8_t)(((p & 0xff) * 255 + a / 2) / a);
+      }
+    }
+  }
+  cairo_surface_destroy(call.surface);
+  return *data != NULL ? 0 : -1;
+}
+
 WEBUI_API void webui_terminate(struct webui *w) {
   w->priv.should_exit = 1;
 }
 
-WEBUI_API void webui_exit(struct webui *w) { (void)w; }
+/*
+ * Releases everything the window owns. Sources and signal handlers that
+ * point at w are removed first, so w can be freed right after this returns
+ * even if WebKit finishes tearing the views down later.
+ */
+WEBUI_API void webui_exit(struct webui *w) {
+  if (w->priv.window == NULL) {
+    return;
+  }
+  while (g_source_remove_by_user_data(w)) {
+  }
+  w->priv.show_timer = 0;
+  w->priv.hang_timer = 0;
+  g_signal_handlers_disconnect_by_data(w->priv.window, w);
+  g_signal_handlers_disconnect_by_data(w->priv.content, w);
+  for (int i = 0; i < WEBUI_SCREEN_CACHE; i++) {
+    if (w->priv.screens[i].view != NULL) {
+      g_signal_handlers_disconnect_by_data(w->priv.screens[i].view, w);
+    }
+    webui_screen_release(&w->priv.screens[i]);
+  }
+  if (!w->priv.destroyed) {
+    if (w->priv.frame_tick != 0) {
+      gtk_widget_remove_tick_callback(w->priv.window, w->priv.frame_tick);
+    }
+    g_signal_handlers_disconnect_by_data(w->priv.webui, w);
+    gtk_widget_destroy(w->priv.window);
+  }
+  g_object_unref(w->priv.window);
+  g_object_unref(w->priv.content);
+  w->priv.window = NULL;
+  w->priv.scroller = NULL;
+  w->priv.webui = NULL;
+  w->priv.content = NULL;
+  w->priv.frame_tick = 0;
+  w->priv.frame_cb = NULL;
+
+  if (webui_surfaces != NULL) {
+    GList *owned = NULL;
+    GHashTableIter iter;
+    gpointer value;
+    g_hash_table_iter_init(&iter, webui_surfaces);
+    while (g_hash_table_iter_next(&iter, NULL, &value)) {
+      if (((struct webui_surface *)value)->w == w) {
+        owned = g_list_prepend(owned, value);
+      }
+    }
+    for (GList *l = owned; l != NULL; l = l->next) {
+      webui_surface_free((struct webui_surface *)l->data);
+    }
+    g_list_free(owned);
+  }
+
+  struct webui_dispatch_arg *arg;
+  while ((arg = (struct webui_dispatch_arg *)g_async_queue_try_pop(
+              w->priv.queue)) != NULL) {
+    g_free(arg);
+  }
+  g_async_queue_unref(w->priv.queue);
+  w->priv.queue = NULL;
+  g_queue_free_full(w->priv.deferred, g_free);
+  w->priv.deferred = NULL;
+  if (w->priv.libraries != NULL) {
+    g_hash_table_destroy(w->priv.libraries);
+    w->priv.libraries = NULL;
+  }
+  if (w->priv.styles != NULL) {
+    g_hash_table_destroy(w->priv.styles);
+    w->priv.styles = NULL;
+  }
+  free(w->priv.script.data);
+  memset(&w->priv.script, 0, sizeof(w->priv.script));
+  g_mutex_clear(&w->priv.visibility_lock);
+}
 WEBUI_API void webui_print_log(const char *s) {
   fprintf(stderr, "%s\n", s);
 }
 
+WEBUI_API void webui_purge_caches(struct webui *w) {
+  WebKitWebContext *ctx =
+      webkit_web_view_get_context(WEBKIT_WEB_VIEW(w->priv.webui));
+  webkit_website_data_manager_clear(
+      webkit_web_context_get_website_data_manager(ctx),
+      WEBKIT_WEBSITE_DATA_MEMORY_CACHE, 0, NULL, NULL, NULL);
+  webkit_web_context_garbage_collect_javascript_objects(ctx);
+}
+
+WEBUI_API void webui_clear_data(struct webui *w, int types) {
+  WebKitWebsiteDataTypes t = 0;
+  if (types & WEBUI_DATA_CACHE) {
+    t |= WEBKIT_WEBSITE_DATA_MEMORY_CACHE | WEBKIT_WEBSITE_DATA_DISK_CACHE;
+  }
+  if (types & WEBUI_DATA_STORAGE) {
+    t |= WEBKIT_WEBSITE_DATA_LOCAL_STORAGE |
+         WEBKIT_WEBSITE_DATA_INDEXEDDB_DATABASES |
+         WEBKIT_WEBSITE_DATA_SESSION_STORAGE;
+  }
+  if (types & WEBUI_DATA_COOKIES) {
+    t |= WEBKIT_WEBSITE_DATA_COOKIES;
+  }
+  WebKitWebContext *ctx =
+      webkit_web_view_get_context(WEBKIT_WEB_VIEW(w->priv.webui));
+  webkit_website_data_manager_clear(
+      webkit_web_context_get_website_data_manager(ctx), t, 0, NULL, NULL,
+      NULL);
+}
+
 WEBUI_API void webui_set_min_size(struct webui *w,int width,int height){
   w->minWidth=width;
   w->minHeight=height;
@@ -0,0 +1,221 @@
+/*
+ * JS string escaping shared by lib/gtk.h and lib/win.h. Bytes outside
+ * printable ASCII and the characters <>\'" become \xHH, everything else is
+ * copied as is. Runs of safe bytes are found 16 or 32 at a time with SSE2
+ * or AVX2 when the compiler targets them, and copied in bulk.
+ */
+#ifndef WEBUI_JSENCODE_H
+#define WEBUI_JSENCODE_H
+
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#define WEBUI_JS_AVX2
+#endif
+#if defined(__SSE2__) || defined(_M_X64) ||                                    \
+    (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define WEBUI_JS_SSE2
+#endif
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+static const unsigned char webui_js_safe[256] = {
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    1, 1, 0, 1, 1, 1, 1, 0, 1, 1, 1, 1, 1, 1, 1, 1,
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 0, 1, 0, 1,
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 0, 1, 1, 1,
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+};
+
+static const char webui_js_hex[] = "0123456789abcdef";
+
+static inline int webui_js_ctz(unsigned int x) {
+#if defined(_MSC_VER)
+  unsigned long i;
+  _BitScanForward(&i, x);
+  return (int)i;
+#else
+  return __builtin_ctz(x);
+#endif
+}
+
+/* Length of the run of safe bytes at the start of s, at most n */
+static inline size_t webui_js_safe_run(const char *s, size_t n) {
+  size_t i = 0;
+#ifdef WEBUI_JS_AVX2
+  {
+    /* signed compare, bytes from 0x80 up are negative and below 0x20 too */
+    const __m256i space = _mm256_set1_epi8(0x20);
+    const __m256i lt = _mm256_set1_epi8('<'), gt = _mm256_set1_epi8('>');
+    const __m256i bs = _mm256_set1_epi8('\\'), sq = _mm256_set1_epi8('\'');
+    const __m256i dq = _mm256_set1_epi8('"');
+    for (; i + 32 <= n; i += 32) {
+      __m256i v = _mm256_loadu_si256((const __m256i *)(s + i));
+      __m256i bad = _mm256_or_si256(
+          _mm256_or_si256(_mm256_cmpgt_epi8(space, v),
+                          _mm256_cmpeq_epi8(v, lt)),
+          _mm256_or_si256(
+              _mm256_or_si256(_mm256_cmpeq_epi8(v, gt),
+                              _mm256_cmpeq_epi8(v, bs)),
+              _mm256_or_si256(_mm256_cmpeq_epi8(v, sq),
+                              _mm256_cmpeq_epi8(v, dq))));
+      unsigned int mask = (unsigned int)_mm256_movemask_epi8(bad);
+      if (mask != 0) {
+        return i + webui_js_ctz(mask);
+      }
+    }
+  }
+#endif
+#ifdef WEBUI_JS_SSE2
+  {
+    const __m128i space = _mm_set1_epi8(0x20);
+    const __m128i lt = _mm_set1_epi8('<'), gt = _mm_set1_epi8('>');
+    const __m128i bs = _mm_set1_epi8('\\'), sq = _mm_set1_epi8('\'');
+    const __m128i dq = _mm_set1_epi8('"');
+    for (; i + 16 <= n; i += 16) {
+      __m128i v = _mm_loadu_si128((const __m128i *)(s + i));
+      __m128i bad = _mm_or_si128(
+          _mm_or_si128(_mm_cmplt_epi8(v, space), _mm_cmpeq_epi8(v, lt)),
+          _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(v, gt),
+                                    _mm_cmpeq_epi8(v, bs)),
+                       _mm_or_si128(_mm_cmpeq_epi8(v, sq),
+                                    _mm_cmpeq_epi8(v, dq))));
+      unsigned int mask = (unsigned int)_mm_movemask_epi8(bad);
+      if (mask != 0) {
+        return i + webui_js_ctz(mask);
+      }
+    }
+  }
+#endif
+  while (i < n && webui_js_safe[(unsigned char)s[i]]) {
+    i++;
+  }
+  return i;
+}
+
+/* Size of the escaped string, including the trailing zero */
+static inline size_t webui_js_encoded_len(const char *s, size_t len) {
+  size_t r = len + 1;
+  for (size_t i = webui_js_safe_run(s, len); i < len;
+       i += 1 + webui_js_safe_run(s + i + 1, len - i - 1)) {
+    r += 3;
+  }
+  return r;
+}
+
+/* Escapes s into out, which must have room for it, and returns its end */
+static inline char *webui_js_encode_to(char *out, const char *s,
+                                       size_t len) {
+  size_t i = 0;
+  while (i < len) {
+    size_t run = webui_js_safe_run(s + i, len - i);
+    memcpy(out, s + i, run);
+    out += run;
+    i += run;
+    if (i < len) {
+      unsigned char c = (unsigned char)s[i++];
+      out[0] = '\\';
+      out[1] = 'x';
+      out[2] = webui_js_hex[c >> 4];
+      out[3] = webui_js_hex[c & 15];
+      out += 4;
+    }
+  }
+  return out;
+}
+
+/*
+ * Escapes s into esc and returns the size it needs including the trailing
+ * zero. With esc NULL or too small nothing is written, so the size can be
+ * queried first.
+ */
+static inline int webui_js_encode(const char *s, char *esc, size_t n) {
+  size_t len = strlen(s);
+  size_t r = webui_js_encoded_len(s, len);
+  if (esc != NULL && n >= r) {
+    *webui_js_encode_to(esc, s, len) = '\0';
+  }
+  return (int)r;
+}
+
+/* A growable zero terminated string to build scripts in a single pass */
+struct webui_buf {
+  char *data;
+  size_t len;
+  size_t cap;
+};
+
+static inline int webui_buf_reserve(struct webui_buf *b, size_t n) {
+  if (b->len + n < b->cap) {
+    return 0;
+  }
+  size_t cap = b->cap > 0 ? b->cap : 64;
+  while (cap <= b->len + n) {
+    cap *= 2;
+  }
+  char *data = (char *)realloc(b->data, cap);
+  if (data == NULL) {
+    return -1;
+  }
+  b->data = data;
+  b->cap = cap;
+  return 0;
+}
+
+static inline int webui_buf_append(struct webui_buf *b, const char *s,
+                                   size_t n) {
+  if (webui_buf_reserve(b, n) != 0) {
+    return -1;
+  }
+  memcpy(b->data + b->len, s, n);
+  b->len += n;
+  b->data[b->len] = '\0';
+  return 0;
+}
+
+static inline int webui_buf_append_str(struct webui_buf *b, const char *s) {
+  return webui_buf_append(b, s, strlen(s));
+}
+
+/* Appends len bytes of s escaped, the input is only read once */
+static inline int webui_buf_append_js(struct webui_buf *b, const char *s,
+                                      size_t len) {
+  /* room for the common case of no escapes, grown when there are some */
+  if (webui_buf_reserve(b, len) != 0) {
+    return -1;
+  }
+  size_t i = 0;
+  while (i < len) {
+    size_t run = webui_js_safe_run(s + i, len - i);
+    if (webui_buf_append(b, s + i, run) != 0 ||
+        (i + run < len && webui_buf_reserve(b, 4) != 0)) {
+      return -1;
+    }
+    i += run;
+    if (i < len) {
+      webui_js_encode_to(b->data + b->len, s + i, 1);
+      b->len += 4;
+      b->data[b->len] = '\0';
+      i++;
+    }
+  }
+  b->data[b->len] = '\0';
+  return 0;
+}
+
+#endif /* WEBUI_JSENCODE_H */
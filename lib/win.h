@@ -19,6 +19,64 @@
 
 #include <stdio.h>
 
+#include "jsencode.h"
+
+/* startup phase timestamps in microseconds of the monotonic clock, 0 when
+ * the phase has not been reached yet */
+struct webui_startup {
+  int64_t init;
+  int64_t committed;
+  int64_t finished;
+  int64_t ready;
+  int64_t shown;
+};
+
+/* Latency histograms in microseconds are log-linear like HdrHistogram:
+ * below 8us every value has its own bucket, above each power of two is split
+ * into 8 linear sub-buckets, so a bucket is at most 12.5% wide. The last
+ * bucket also holds everything from 2^31us on. */
+#define WEBUI_HISTOGRAM_SUB_BITS 3
+#define WEBUI_HISTOGRAM_BUCKETS 232
+
+/* cumulative counters of a window, see webui_get_stats() */
+struct webui_stats {
+  uint64_t evals;
+  uint64_t invokes;
+  uint64_t dispatches;
+  uint64_t bytes_to_page;   /* JS code sent with eval */
+  uint64_t bytes_from_page; /* invoke messages */
+  int queue_depth;          /* dispatched functions waiting to run */
+  int evals_in_flight;
+  uint64_t eval_latency[WEBUI_HISTOGRAM_BUCKETS];
+  uint64_t invoke_latency[WEBUI_HISTOGRAM_BUCKETS];   /* in the callback */
+  uint64_t dispatch_latency[WEBUI_HISTOGRAM_BUCKETS]; /* queued to run */
+  /* with input_latency set: presses and scrolls, the time until the page
+   * painted the frame after them and to the first invoke they trigger */
+  uint64_t inputs;
+  uint64_t input_paint_latency[WEBUI_HISTOGRAM_BUCKETS];
+  uint64_t input_handler_latency[WEBUI_HISTOGRAM_BUCKETS];
+  /* time spent visible and hidden and the CPU time this process used in
+   * each, in microseconds; evals deferred while hidden with throttle_hidden */
+  int64_t visible_time;
+  int64_t hidden_time;
+  int64_t cpu_visible;
+  int64_t cpu_hidden;
+  uint64_t deferred_evals;
+  uint64_t eval_timeouts; /* evals given up on after their timeout */
+  uint64_t eval_cancels;  /* and with webui_eval_cancel() */
+};
+
+/* zeroed by the caller, webui_eval_cancel() stops the webui_eval_timeout()
+ * calls it was passed to */
+struct webui_cancel {
+  int cancelled;
+};
+
+struct webui;
+
+typedef void (*webui_frame_cb)(struct webui *w, int64_t frame_time,
+                               int64_t frame_counter);
+
 struct webui_priv {
   HWND hwnd;
   IOleObject **browser;
@@ -26,6 +84,10 @@ struct webui_priv {
   DWORD saved_style;
   DWORD saved_ex_style;
   RECT saved_rect;
+  webui_frame_cb frame_cb;
+  int64_t frame_counter;
+  struct webui_stats stats;
+  int styles_next;
 };
 
 
@@ -34,6 +96,15 @@ struct webui;
 typedef void (*webui_external_invoke_cb_t)(struct webui *w,
                                              const char *arg);
 typedef int (*webui_close_cb)(struct webui *w);
+/* ts is microseconds of the monotonic clock, data is the error message of
+ * WEBUI_LOAD_FAILED and the JSON timing entries of WEBUI_LOAD_TIMING */
+typedef void (*webui_load_cb)(struct webui *w, int event, int64_t ts,
+                              const char *uri, const char *data);
+/* visible is 0 while the window is minimized or unmapped */
+typedef void (*webui_visibility_cb)(struct webui *w, int visible, int focused);
+/* called once the page has been reloaded in a new web process, the page
+ * state and anything injected with webui_eval() are gone */
+typedef void (*webui_recover_cb)(struct webui *w, int reason);
 
 enum webui_border_type{
   WEBUI_BORDER_NONE=2,
@@ -41,6 +112,76 @@ enum webui_border_type{
   WEBUI_BORDER_RESIZABLE=0
 };
 
+enum webui_cache_model{
+  WEBUI_CACHE_DEFAULT=0,
+  WEBUI_CACHE_DOCUMENT_VIEWER=1,
+  WEBUI_CACHE_DOCUMENT_BROWSER=2,
+  WEBUI_CACHE_WEB_BROWSER=3
+};
+
+enum webui_process_model{
+  WEBUI_PROCESS_DEFAULT=0,
+  WEBUI_PROCESS_SHARED=1,
+  WEBUI_PROCESS_PER_VIEW=2
+};
+
+enum webui_feature{
+  WEBUI_FEATURE_PLUGINS=1 << 0,
+  WEBUI_FEATURE_SPELL_CHECKING=1 << 1, /* process-wide, like FAVICONS */
+  WEBUI_FEATURE_PAGE_CACHE=1 << 2,
+  WEBUI_FEATURE_SMOOTH_SCROLLING=1 << 3,
+  WEBUI_FEATURE_WEBGL=1 << 4,
+  WEBUI_FEATURE_MEDIA_SOURCE=1 << 5,
+  WEBUI_FEATURE_FAVICONS=1 << 6,
+  WEBUI_FEATURE_MODAL_DIALOGS=1 << 7
+};
+/* every optional feature off, for minimal memory and startup time */
+#define WEBUI_PROFILE_LEAN 0xff
+
+enum webui_data_type{
+  WEBUI_DATA_CACHE=1 << 0,
+  WEBUI_DATA_STORAGE=1 << 1,
+  WEBUI_DATA_COOKIES=1 << 2,
+  WEBUI_DATA_ALL=7
+};
+
+enum webui_show_mode{
+  WEBUI_SHOW_IMMEDIATE=0,
+  WEBUI_SHOW_ON_COMMIT=1, /* first content of the page is committed */
+  WEBUI_SHOW_ON_LOAD=2,
+  WEBUI_SHOW_ON_READY=3 /* webui_ready() or window.external.ready() */
+};
+
+enum webui_load_event{
+  WEBUI_LOAD_STARTED=0,
+  WEBUI_LOAD_REDIRECTED=1,
+  WEBUI_LOAD_COMMITTED=2,
+  WEBUI_LOAD_FINISHED=3,
+  WEBUI_LOAD_FAILED=4,
+  WEBUI_LOAD_TIMING=5 /* navigation and resource timing, after finished */
+};
+
+enum webui_recover_reason{
+  WEBUI_RECOVER_CRASHED=0,
+  WEBUI_RECOVER_OUT_OF_MEMORY=1,
+  WEBUI_RECOVER_UNRESPONSIVE=2 /* killed after hang_timeout */
+};
+
+/* commands of webui_batch_exec(), see there for the buffer layout */
+enum webui_batch_op{
+  WEBUI_BATCH_EVAL=1,
+  WEBUI_BATCH_INJECT_CSS=2,
+  WEBUI_BATCH_SET_TITLE=3,
+  WEBUI_BATCH_SET_COLOR=4,      /* arg is 0xRRGGBBAA */
+  WEBUI_BATCH_SET_FULLSCREEN=5, /* arg is 0 or 1 */
+  WEBUI_BATCH_STYLE_REPLACE=6   /* arg is the style sheet id */
+};
+
+enum webui_snapshot_format{
+  WEBUI_SNAPSHOT_RGBA=0,
+  WEBUI_SNAPSHOT_PNG=1
+};
+
 struct webui {
   const char *url;
   const char *title;
@@ -50,8 +191,35 @@ struct webui {
   int minHeight;
   int border;
   int debug;
+  /* web process tuning, shared by all windows and taken from the first one */
+  int cache_model;
+  int process_model;
+  int memory_limit; /* MB, 0 is the WebKit default */
+  double memory_conservative_threshold;
+  double memory_strict_threshold;
+  double memory_kill_threshold;
+  unsigned int disabled_features; /* enum webui_feature bits */
+  /* persistent website data and HTTP cache, NULL for the defaults */
+  const char *data_dir;
+  const char *cache_dir;
+  int cache_purge; /* MB, the disk cache is cleared at startup above it */
+  int show_mode;
+  int show_timeout; /* ms before the window is shown anyway, 0 is 3000 */
+  int offscreen;
+  int input_latency; /* measure input latency into the stats */
+  /* while hidden: suspend the frame callback and defer webui_eval() */
+  int throttle_hidden;
+  int eval_timeout; /* ms before webui_eval() gives up, 0 waits forever */
+  int hang_timeout; /* ms an unresponsive web process is given, 0 forever */
+  /* inline HTML loaded instead of url, base_uri resolves its relative URLs */
+  const char *html;
+  size_t html_len;
+  const char *base_uri;
   webui_external_invoke_cb_t external_invoke_cb;
   webui_close_cb close_cb;
+  webui_load_cb load_cb;
+  webui_visibility_cb visibility_cb;
+  webui_recover_cb recover_cb;
   struct webui_priv priv;
   void *userdata;
 };
@@ -86,12 +254,24 @@ enum webui_file_type{
 };
 
 
+struct webui_surface;
+
+struct webui_surface_stats {
+  uint64_t committed;
+  uint64_t presented;
+  uint64_t dropped;
+  int64_t latency_last; /* commit to hand-off to the page, microseconds */
+  int64_t latency_avg;
+  int64_t latency_max;
+};
+
 typedef void (*webui_dispatch_fn)(struct webui *w, void *arg);
 
 struct webui_dispatch_arg {
   webui_dispatch_fn fn;
   struct webui *w;
   void *arg;
+  int64_t queued;
 };
 
 #define DEFAULT_URL                                                            \
@@ -122,18 +302,67 @@ WEBUI_API int webui(const char *title, const char *url, int width,
 WEBUI_API int webui_init(struct webui *w);
 WEBUI_API int webui_loop(struct webui *w, int blocking);
 WEBUI_API int webui_eval(struct webui *w, const char *js);
+WEBUI_API int webui_eval_result(struct webui *w, const char *js, char **result);
+WEBUI_API int webui_eval_n(struct webui *w, const char *js, size_t len);
+WEBUI_API int webui_eval_result_n(struct webui *w, const char *js, size_t len,
+                                  char **result);
+WEBUI_API int webui_eval_async(struct webui *w, const char *js, size_t len);
+WEBUI_API int webui_eval_timeout(struct webui *w, const char *js, size_t len,
+                                 int timeout, struct webui_cancel *cancel,
+                                 char **result);
+WEBUI_API void webui_eval_cancel(struct webui_cancel *cancel);
+WEBUI_API int webui_wait_ready(struct webui *w, int timeout);
+WEBUI_API int webui_iterate(int blocking);
+WEBUI_API void webui_wakeup(void);
 WEBUI_API int webui_inject_css(struct webui *w, const char *css);
+WEBUI_API int webui_inject_css_n(struct webui *w, const char *css, size_t len);
+WEBUI_API int webui_add_user_script(struct webui *w, const char *js);
+WEBUI_API void webui_register_library(const char *name, const char *js);
+WEBUI_API int webui_use_library(struct webui *w, const char *name);
+WEBUI_API int webui_style_add(struct webui *w, const char *css);
+WEBUI_API int webui_style_replace(struct webui *w, int id, const char *css);
+WEBUI_API int webui_style_replace_n(struct webui *w, int id, const char *css,
+                                  size_t len);
+WEBUI_API int webui_style_remove(struct webui *w, int id);
+WEBUI_API int webui_batch_exec(struct webui *w, const char *buf, size_t len,
+                               int *results, int nresults);
 WEBUI_API void webui_set_title(struct webui *w, const char *title);
+WEBUI_API void webui_set_title_n(struct webui *w, const char *title,
+                                 size_t len);
+WEBUI_API void webui_ready(struct webui *w);
+WEBUI_API void webui_get_startup(struct webui *w, struct webui_startup *startup);
+WEBUI_API void webui_navigate(struct webui *w, const char *url);
+WEBUI_API void webui_load_html(struct webui *w, const char *html, size_t len,
+                               const char *base_uri);
+WEBUI_API void webui_prerender(struct webui *w, const char *url);
 WEBUI_API void webui_set_fullscreen(struct webui *w, int fullscreen);
 WEBUI_API void webui_set_color(struct webui *w, uint8_t r, uint8_t g,uint8_t b, uint8_t a);
+WEBUI_API void webui_on_frame(struct webui *w, webui_frame_cb cb);
 WEBUI_API void webui_dispatch(struct webui *w, webui_dispatch_fn fn,void *arg);
 WEBUI_API void webui_terminate(struct webui *w);
 WEBUI_API void webui_exit(struct webui *w);
 WEBUI_API void webui_debug(const char *format, ...);
 WEBUI_API void webui_print_log(const char *s);
 WEBUI_API void webui_set_min_size(struct webui *w,int width,int height);
+WEBUI_API void webui_purge_caches(struct webui *w);
+WEBUI_API void webui_clear_data(struct webui *w, int types);
 WEBUI_API int webui_msg(struct webui *w,enum webui_msg_type flag,const char *title,const char *msg);
+WEBUI_API int webui_msg_n(struct webui *w, enum webui_msg_type flag,
+                          const char *title, size_t title_len, const char *msg,
+                          size_t msg_len);
 WEBUI_API void webui_file(struct webui *w,enum webui_file_type flag,const char *filter,char *result, size_t resultsz);
+WEBUI_API struct webui_surface *webui_surface_new(struct webui *w, const char *canvas, int width, int height);
+WEBUI_API uint8_t *webui_surface_pixels(struct webui_surface *s);
+WEBUI_API int webui_surface_commit(struct webui_surface *s);
+WEBUI_API void webui_surface_stats(struct webui_surface *s, struct webui_surface_stats *stats);
+WEBUI_API void webui_surface_free(struct webui_surface *s);
+WEBUI_API int webui_snapshot(struct webui *w, int format, int full_document, uint8_t **data, size_t *len, int *width, int *height);
+WEBUI_API void webui_trace_enable(int capacity);
+WEBUI_API int64_t webui_trace_now(void);
+WEBUI_API void webui_trace_add(struct webui *w, const char *cat, const char *name, int64_t ts, int64_t dur, int64_t size);
+WEBUI_API int webui_trace_collect_page(struct webui *w);
+WEBUI_API int webui_trace_dump(const char *path);
+WEBUI_API void webui_get_stats(struct webui *w, struct webui_stats *stats);
 
 
 WEBUI_API int webui(const char *title, const char *url, int width,int height, int border) {
@@ -154,6 +383,70 @@ WEBUI_API int webui(const char *title, const char *url, int width,int height, in
   return 0;
 }
 
+/* counters are updated with relaxed atomics, dispatch runs on any thread.
+ * The fields are int or 64 bit wide. */
+#if defined(_MSC_VER)
+#define webui_stats_add(field, n)                                              \
+  (sizeof(field) == 8                                                          \
+       ? (void)InterlockedExchangeAdd64((volatile LONG64 *)&(field),           \
+                                        (LONG64)(n))                           \
+       : (void)InterlockedExchangeAdd((volatile LONG *)&(field), (LONG)(n)))
+#define webui_stats_load(field)                                                \
+  (sizeof(field) == 8                                                          \
+       ? (int64_t)InterlockedCompareExchange64((volatile LONG64 *)&(field), 0, \
+                                               0)                              \
+       : (int64_t)InterlockedCompareExchange((volatile LONG *)&(field), 0, 0))
+#else
+#define webui_stats_add(field, n) __atomic_fetch_add(&(field), (n), __ATOMIC_RELAXED)
+#define webui_stats_load(field) __atomic_load_n(&(field), __ATOMIC_RELAXED)
+#endif
+
+static void webui_stats_record(uint64_t *histogram, int64_t us) {
+  const int sub = 1 << WEBUI_HISTOGRAM_SUB_BITS;
+  int i;
+  if (us < sub) {
+    i = us < 0 ? 0 : (int)us;
+  } else {
+    int msb = 0;
+    for (int64_t v = us; v > 1; v >>= 1) {
+      msb++;
+    }
+    int shift = msb - WEBUI_HISTOGRAM_SUB_BITS;
+    i = sub + shift * sub + (int)((us >> shift) & (sub - 1));
+    if (i > WEBUI_HISTOGRAM_BUCKETS - 1) {
+      i = WEBUI_HISTOGRAM_BUCKETS - 1;
+    }
+  }
+  webui_stats_add(histogram[i], 1);
+}
+
+WEBUI_API void webui_get_stats(struct webui *w, struct webui_stats *stats) {
+  struct webui_stats *s = &w->priv.stats;
+  stats->evals = webui_stats_load(s->evals);
+  stats->invokes = webui_stats_load(s->invokes);
+  stats->dispatches = webui_stats_load(s->dispatches);
+  stats->bytes_to_page = webui_stats_load(s->bytes_to_page);
+  stats->bytes_from_page = webui_stats_load(s->bytes_from_page);
+  stats->queue_depth = webui_stats_load(s->queue_depth);
+  stats->evals_in_flight = webui_stats_load(s->evals_in_flight);
+  for (int i = 0; i < WEBUI_HISTOGRAM_BUCKETS; i++) {
+    stats->eval_latency[i] = webui_stats_load(s->eval_latency[i]);
+    stats->invoke_latency[i] = webui_stats_load(s->invoke_latency[i]);
+    stats->dispatch_latency[i] = webui_stats_load(s->dispatch_latency[i]);
+    stats->input_paint_latency[i] = webui_stats_load(s->input_paint_latency[i]);
+    stats->input_handler_latency[i] =
+        webui_stats_load(s->input_handler_latency[i]);
+  }
+  stats->inputs = webui_stats_load(s->inputs);
+  stats->visible_time = webui_stats_load(s->visible_time);
+  stats->hidden_time = webui_stats_load(s->hidden_time);
+  stats->cpu_visible = webui_stats_load(s->cpu_visible);
+  stats->cpu_hidden = webui_stats_load(s->cpu_hidden);
+  stats->deferred_evals = webui_stats_load(s->deferred_evals);
+  stats->eval_timeouts = webui_stats_load(s->eval_timeouts);
+  stats->eval_cancels = webui_stats_load(s->eval_cancels);
+}
+
 WEBUI_API void webui_debug(const char *format, ...) {
   char buf[4096];
   va_list ap;
@@ -163,50 +456,123 @@ WEBUI_API void webui_debug(const char *format, ...) {
   va_end(ap);
 }
 
-static int webui_js_encode(const char *s, char *esc, size_t n) {
-  int r = 1; /* At least one byte for trailing zero */
-  for (; *s; s++) {
-    const unsigned char c = *s;
-    if (c >= 0x20 && c < 0x80 && strchr("<>\\'\"", c) == NULL) {
-      if (n > 0) {
-        *esc++ = c;
-        n--;
-      }
-      r++;
-    } else {
-      if (n > 0) {
-        snprintf(esc, n, "\\x%02x", (int)c);
-        esc += 4;
-        n -= 4;
-      }
-      r += 4;
-    }
+WEBUI_API int webui_inject_css(struct webui *w, const char *css) {
+  return webui_inject_css_n(w, css, strlen(css));
+}
+
+WEBUI_API int webui_inject_css_n(struct webui *w, const char *css,
+                                 size_t len) {
+  struct webui_buf js = {NULL, 0, 0};
+  int r = -1;
+  if (webui_buf_append_str(&js, CSS_INJECT_FUNCTION "(\"") == 0 &&
+      webui_buf_append_js(&js, css, len) == 0 &&
+      webui_buf_append_str(&js, "\")") == 0) {
+    r = webui_eval(w, js.data);
   }
+  free(js.data);
   return r;
 }
 
-WEBUI_API int webui_inject_css(struct webui *w, const char *css) {
-  int n = webui_js_encode(css, NULL, 0);
-  char *esc = (char *)calloc(1, sizeof(CSS_INJECT_FUNCTION) + n + 4);
-  if (esc == NULL) {
-    return -1;
+#define STYLE_SET_FUNCTION                                                     \
+  "(function(i,c){var "                                                        \
+  "d=document,t=d.getElementById(i);if(!t){t=d.createElement('style');t.id=i;" \
+  "t.setAttribute('type','text/css');(d.head||d.getElementsByTagName('head')"  \
+  "[0]).appendChild(t)}t.styleSheet?t.styleSheet.cssText=c:t.innerHTML=c})"
+
+static int webui_style_set(struct webui *w, int id, const char *css,
+                           size_t len) {
+  struct webui_buf js = {NULL, 0, 0};
+  char head[64];
+  int r = -1;
+  snprintf(head, sizeof(head), "('webui-style-%d',\"", id);
+  if (webui_buf_append_str(&js, STYLE_SET_FUNCTION) == 0 &&
+      webui_buf_append_str(&js, head) == 0 &&
+      webui_buf_append_js(&js, css, len) == 0 &&
+      webui_buf_append_str(&js, "\")") == 0) {
+    r = webui_eval(w, js.data);
   }
-  char *js = (char *)calloc(1, n);
-  webui_js_encode(css, js, n);
-  snprintf(esc, sizeof(CSS_INJECT_FUNCTION) + n + 4, "%s(\"%s\")",
-           CSS_INJECT_FUNCTION, js);
-  int r = webui_eval(w, esc);
-  free(js);
-  free(esc);
+  free(js.data);
   return r;
 }
 
+/* MSHTML has no user style sheets, styles are <style> elements in the
+ * current page that are updated by id */
+WEBUI_API int webui_style_add(struct webui *w, const char *css) {
+  int id = ++w->priv.styles_next;
+  return webui_style_set(w, id, css, strlen(css)) == 0 ? id : -1;
+}
+
+WEBUI_API int webui_style_replace(struct webui *w, int id, const char *css) {
+  return webui_style_replace_n(w, id, css, strlen(css));
+}
+
+WEBUI_API int webui_style_replace_n(struct webui *w, int id, const char *css,
+                                   size_t len) {
+  if (id <= 0 || id > w->priv.styles_next) {
+    return -1;
+  }
+  return webui_style_set(w, id, css, len);
+}
+
+WEBUI_API int webui_style_remove(struct webui *w, int id) {
+  char js[128];
+  if (id <= 0 || id > w->priv.styles_next) {
+    return -1;
+  }
+  snprintf(js, sizeof(js),
+           "(function(t){t&&t.parentNode.removeChild(t)})"
+           "(document.getElementById('webui-style-%d'))",
+           id);
+  return webui_eval(w, js);
+}
+
+/* MSHTML has no user scripts, the script only runs in the current page */
+WEBUI_API int webui_add_user_script(struct webui *w, const char *js) {
+  return webui_eval(w, js);
+}
+
+struct webui_library {
+  char *name;
+  char *source;
+  struct webui_library *next;
+};
+
+static struct webui_library *webui_libraries = NULL;
+
+WEBUI_API void webui_register_library(const char *name, const char *js) {
+  for (struct webui_library *lib = webui_libraries; lib != NULL;
+       lib = lib->next) {
+    if (strcmp(lib->name, name) == 0) {
+      return;
+    }
+  }
+  struct webui_library *lib =
+      (struct webui_library *)calloc(1, sizeof(struct webui_library));
+  lib->name = strdup(name);
+  lib->source = strdup(js);
+  lib->next = webui_libraries;
+  webui_libraries = lib;
+}
+
+WEBUI_API int webui_use_library(struct webui *w, const char *name) {
+  for (struct webui_library *lib = webui_libraries; lib != NULL;
+       lib = lib->next) {
+    if (strcmp(lib->name, name) == 0) {
+      return webui_eval(w, lib->source);
+    }
+  }
+  return -1;
+}
+
+
+#include "batch.h"
 
 #pragma comment(lib, "user32.lib")
 #pragma comment(lib, "ole32.lib")
 #pragma comment(lib, "oleaut32.lib")
 
 #define WM_WEBUI_DISPATCH (WM_APP + 1)
+#define WEBUI_FRAME_TIMER 1
 
 typedef struct {
   IOleInPlaceFrame frame;
@@ -254,6 +620,19 @@ static inline WCHAR *webui_to_utf16(const char *s) {
   return ws;
 }
 
+static inline WCHAR *webui_to_utf16_n(const char *s, size_t len) {
+  int size = len > 0 ? MultiByteToWideChar(CP_UTF8, 0, s, (int)len, 0, 0) : 0;
+  WCHAR *ws = (WCHAR *)GlobalAlloc(GMEM_FIXED, sizeof(WCHAR) * (size + 1));
+  if (ws == NULL) {
+    return NULL;
+  }
+  if (size > 0) {
+    MultiByteToWideChar(CP_UTF8, 0, s, (int)len, ws, size);
+  }
+  ws[size] = 0;
+  return ws;
+}
+
 static inline char *webui_from_utf16(WCHAR *ws) {
   int n = WideCharToMultiByte(CP_UTF8, 0, ws, -1, NULL, 0, NULL, NULL);
   char *s = (char *)GlobalAlloc(GMEM_FIXED, n);
@@ -319,7 +698,12 @@ JS_Invoke(IDispatch FAR *This, DISPID dispIdMember, REFIID riid, LCID lcid,
     if (s != NULL) {
       if (dispIdMember == WEBUI_JS_INVOKE_ID) {
         if (w->external_invoke_cb != NULL) {
+          int64_t ts = webui_trace_now();
           w->external_invoke_cb(w, s);
+          webui_stats_add(w->priv.stats.invokes, 1);
+          webui_stats_add(w->priv.stats.bytes_from_page, strlen(s));
+          webui_stats_record(w->priv.stats.invoke_latency,
+                             webui_trace_now() - ts);
         }
       } else {
         return S_FALSE;
@@ -954,10 +1338,25 @@ static LRESULT CALLBACK wndproc(HWND hwnd, UINT uMsg, WPARAM wParam,
     return TRUE;
     
   }
+  case WM_TIMER:
+    if (w != NULL && wParam == WEBUI_FRAME_TIMER && w->priv.frame_cb != NULL) {
+      LARGE_INTEGER t, f;
+      QueryPerformanceCounter(&t);
+      QueryPerformanceFrequency(&f);
+      int64_t us = (t.QuadPart / f.QuadPart) * 1000000 +
+                   (t.QuadPart % f.QuadPart) * 1000000 / f.QuadPart;
+      w->priv.frame_cb(w, us, ++w->priv.frame_counter);
+      return TRUE;
+    }
+    break;
   case WM_WEBUI_DISPATCH: {
-    webui_dispatch_fn f = (webui_dispatch_fn)wParam;
-    void *arg = (void *)lParam;
-    (*f)(w, arg);
+    struct webui_dispatch_arg *arg = (struct webui_dispatch_arg *)lParam;
+    webui_stats_add(w->priv.stats.queue_depth, -1);
+    webui_stats_record(w->priv.stats.dispatch_latency,
+                       webui_trace_now() - arg->queued);
+    (arg->fn)(w, arg->arg);
+    webui_stats_add(w->priv.stats.dispatches, 1);
+    free(arg);
     return TRUE;
   }
   }
@@ -1054,13 +1453,22 @@ WEBUI_API int webui_init(struct webui *w) {
 
   SetWindowLongPtr(w->priv.hwnd, GWLP_USERDATA, (LONG_PTR)w);
 
-  DisplayHTMLPage(w);
+  if (w->html != NULL) {
+    webui_load_html(w, w->html, w->html_len, w->base_uri);
+  } else {
+    DisplayHTMLPage(w);
+  }
   WCHAR *Ltitle=webui_to_utf16(w->title);
   SetWindowTextW(w->priv.hwnd,Ltitle);
   GlobalFree(Ltitle);
-  ShowWindow(w->priv.hwnd, SW_SHOWDEFAULT);
-  UpdateWindow(w->priv.hwnd);
-  SetFocus(w->priv.hwnd);
+  if (w->offscreen) {
+    /* a hidden window is the closest MSHTML has to offscreen rendering */
+    ShowWindow(w->priv.hwnd, SW_HIDE);
+  } else {
+    ShowWindow(w->priv.hwnd, SW_SHOWDEFAULT);
+    UpdateWindow(w->priv.hwnd);
+    SetFocus(w->priv.hwnd);
+  }
   
   return 0;
 }
@@ -1103,7 +1511,25 @@ WEBUI_API int webui_loop(struct webui *w, int blocking) {
   return 0;
 }
 
+static int webui_eval_script(struct webui *w, const char *js, size_t len);
+
 WEBUI_API int webui_eval(struct webui *w, const char *js) {
+  return webui_eval_n(w, js, strlen(js));
+}
+
+/* js needs no trailing zero and is not used after the call returns */
+WEBUI_API int webui_eval_n(struct webui *w, const char *js, size_t len) {
+  int64_t ts = webui_trace_now();
+  webui_stats_add(w->priv.stats.evals_in_flight, 1);
+  int r = webui_eval_script(w, js, len);
+  webui_stats_add(w->priv.stats.evals_in_flight, -1);
+  webui_stats_add(w->priv.stats.evals, 1);
+  webui_stats_add(w->priv.stats.bytes_to_page, len);
+  webui_stats_record(w->priv.stats.eval_latency, webui_trace_now() - ts);
+  return r;
+}
+
+static int webui_eval_script(struct webui *w, const char *js, size_t len) {
   IWebBrowser2 *webBrowser2;
   IHTMLDocument2 *htmlDoc2;
   IDispatch *docDispatch;
@@ -1145,32 +1571,107 @@ WEBUI_API int webui_eval(struct webui *w, const char *js) {
   params.cNamedArgs = 0;
   params.rgvarg = &arg;
   arg.vt = VT_BSTR;
-  static const char *prologue = "(function(){";
-  static const char *epilogue = ";})();";
-  int n = strlen(prologue) + strlen(epilogue) + strlen(js) + 1;
-  char *eval = (char *)malloc(n);
-  snprintf(eval, n, "%s%s%s", prologue, js, epilogue);
-  wchar_t *buf = webui_to_utf16(eval);
-  if (buf == NULL) {
+  /* the script is converted straight into the BSTR, wrapped in a function */
+  static const char prologue[] = "(function(){";
+  static const char epilogue[] = ";})();";
+  const int np = sizeof(prologue) - 1, ne = sizeof(epilogue) - 1;
+  int nj = len > 0 ? MultiByteToWideChar(CP_UTF8, 0, js, (int)len, NULL, 0) : 0;
+  arg.bstrVal = SysAllocStringLen(NULL, np + nj + ne);
+  if (arg.bstrVal == NULL) {
     return -1;
   }
-  arg.bstrVal = SysAllocString(buf);
+  MultiByteToWideChar(CP_UTF8, 0, prologue, np, arg.bstrVal, np);
+  if (nj > 0) {
+    MultiByteToWideChar(CP_UTF8, 0, js, (int)len, arg.bstrVal + np, nj);
+  }
+  MultiByteToWideChar(CP_UTF8, 0, epilogue, ne, arg.bstrVal + np + nj, ne);
   if (scriptDispatch->lpVtbl->Invoke(
           scriptDispatch, dispid, iid_unref(&IID_NULL), 0, DISPATCH_METHOD,
           &params, &result, &excepInfo, &nArgErr) != S_OK) {
     return -1;
   }
   SysFreeString(arg.bstrVal);
-  free(eval);
   scriptDispatch->lpVtbl->Release(scriptDispatch);
   htmlDoc2->lpVtbl->Release(htmlDoc2);
   docDispatch->lpVtbl->Release(docDispatch);
   return 0;
 }
 
+/* MSHTML eval() results are not converted to JSON */
+WEBUI_API int webui_eval_result(struct webui *w, const char *js,
+                                char **result) {
+  *result = strdup("null");
+  return webui_eval(w, js);
+}
+
+WEBUI_API int webui_eval_result_n(struct webui *w, const char *js, size_t len,
+                                  char **result) {
+  *result = strdup("null");
+  return webui_eval_n(w, js, len);
+}
+
+/* MSHTML runs the script synchronously, it never waits for a nested loop */
+WEBUI_API int webui_eval_async(struct webui *w, const char *js, size_t len) {
+  return webui_eval_n(w, js, len);
+}
+
+/* MSHTML runs the script synchronously, there is nothing to wait for or to
+ * cancel */
+WEBUI_API int webui_eval_timeout(struct webui *w, const char *js, size_t len,
+                                 int timeout, struct webui_cancel *cancel,
+                                 char **result) {
+  (void)timeout;
+  (void)cancel;
+  if (result != NULL) {
+    *result = strdup("null");
+  }
+  return webui_eval_n(w, js, len);
+}
+
+WEBUI_API void webui_eval_cancel(struct webui_cancel *cancel) {
+  (void)cancel;
+}
+
+WEBUI_API int webui_wait_ready(struct webui *w, int timeout) {
+  (void)w;
+  (void)timeout;
+  return 0;
+}
+
+WEBUI_API int webui_iterate(int blocking) {
+  MSG msg;
+  if (blocking) {
+    GetMessage(&msg, 0, 0, 0);
+  } else if (!PeekMessage(&msg, 0, 0, 0, PM_REMOVE)) {
+    return 0;
+  }
+  TranslateMessage(&msg);
+  DispatchMessage(&msg);
+  return 1;
+}
+
+WEBUI_API void webui_wakeup(void) {}
+
 WEBUI_API void webui_dispatch(struct webui *w, webui_dispatch_fn fn,
                                   void *arg) {
-  PostMessageW(w->priv.hwnd, WM_WEBUI_DISPATCH, (WPARAM)fn, (LPARAM)arg);
+  struct webui_dispatch_arg *context =
+      (struct webui_dispatch_arg *)malloc(sizeof(struct webui_dispatch_arg));
+  context->w = w;
+  context->arg = arg;
+  context->fn = fn;
+  context->queued = webui_trace_now();
+  webui_stats_add(w->priv.stats.queue_depth, 1);
+  PostMessageW(w->priv.hwnd, WM_WEBUI_DISPATCH, 0, (LPARAM)context);
+}
+
+/* There is no frame clock, a ~60Hz timer drives the callback instead */
+WEBUI_API void webui_on_frame(struct webui *w, webui_frame_cb cb) {
+  if (cb != NULL && w->priv.frame_cb == NULL) {
+    SetTimer(w->priv.hwnd, WEBUI_FRAME_TIMER, 16, NULL);
+  } else if (cb == NULL && w->priv.frame_cb != NULL) {
+    KillTimer(w->priv.hwnd, WEBUI_FRAME_TIMER);
+  }
+  w->priv.frame_cb = cb;
 }
 
 WEBUI_API void webui_set_title(struct webui *w, const char *title) {
@@ -1179,6 +1680,54 @@ WEBUI_API void webui_set_title(struct webui *w, const char *title) {
   GlobalFree(Ltitle);
 }
 
+WEBUI_API void webui_set_title_n(struct webui *w, const char *title,
+                                 size_t len) {
+  WCHAR *Ltitle = webui_to_utf16_n(title, len);
+  SetWindowTextW(w->priv.hwnd, Ltitle);
+  GlobalFree(Ltitle);
+}
+
+WEBUI_API void webui_navigate(struct webui *w, const char *url) {
+  const char *prev = w->url;
+  w->url = url;
+  DisplayHTMLPage(w);
+  w->url = prev;
+}
+
+/*
+ * MSHTML writes data: URLs into about:blank, which only needs '%' escaped.
+ * The base URI is not supported.
+ */
+WEBUI_API void webui_load_html(struct webui *w, const char *html, size_t len,
+                               const char *base_uri) {
+  (void)base_uri;
+  size_t n = strlen(WEBUI_DATA_URL_PREFIX) + 1;
+  for (size_t i = 0; i < len; i++) {
+    n += html[i] == '%' ? 3 : 1;
+  }
+  char *url = (char *)malloc(n);
+  if (url == NULL) {
+    return;
+  }
+  char *q = url + sprintf(url, "%s", WEBUI_DATA_URL_PREFIX);
+  for (size_t i = 0; i < len; i++) {
+    if (html[i] == '%') {
+      q += sprintf(q, "%%25");
+    } else {
+      *q++ = html[i];
+    }
+  }
+  *q = '\0';
+  webui_navigate(w, url);
+  free(url);
+}
+
+/* MSHTML has a single browser object per window, nothing to prerender */
+WEBUI_API void webui_prerender(struct webui *w, const char *url) {
+  (void)w;
+  (void)url;
+}
+
 WEBUI_API void webui_set_fullscreen(struct webui *w, int fullscreen) {
   if (w->priv.is_fullscreen == !!fullscreen) {
     return;
@@ -1310,6 +1859,12 @@ DEFINE_GUID(IID_IFileSaveDialog, 0x84bccd23, 0x5fde, 0x4cdb, 0xae, 0xa4, 0xaf,
 #endif
 
 WEBUI_API int webui_msg(struct webui *w,enum webui_msg_type flag,const char *title,const char *msg){
+  return webui_msg_n(w, flag, title, strlen(title), msg, strlen(msg));
+}
+
+WEBUI_API int webui_msg_n(struct webui *w, enum webui_msg_type flag,
+                          const char *title, size_t title_len, const char *msg,
+                          size_t msg_len) {
   UINT type = 0;
   switch (flag & WEBUI_MSG_ICON_MASK){
   case WEBUI_MSG_INFO:
@@ -1338,8 +1893,8 @@ WEBUI_API int webui_msg(struct webui *w,enum webui_msg_type flag,const char *tit
     type|=MB_OK;
     break;
   }
-  WCHAR *Ltitle=webui_to_utf16(title);
-  WCHAR *Lmsg=webui_to_utf16(msg);
+  WCHAR *Ltitle = webui_to_utf16_n(title, title_len);
+  WCHAR *Lmsg = webui_to_utf16_n(msg, msg_len);
   int res=MessageBoxW(w->priv.hwnd, Lmsg, Ltitle, type); 
   GlobalFree(Ltitle);
   GlobalFree(Lmsg);
@@ -1428,15 +1983,123 @@ WEBUI_API void webui_file(struct webui *w,enum webui_file_type flag,const char *
 }
 
 
+/* Surfaces need a custom URI scheme, which MSHTML does not offer */
+WEBUI_API struct webui_surface *webui_surface_new(struct webui *w,
+                                                  const char *canvas,
+                                                  int width, int height) {
+  (void)w;
+  (void)canvas;
+  (void)width;
+  (void)height;
+  return NULL;
+}
+
+WEBUI_API uint8_t *webui_surface_pixels(struct webui_surface *s) {
+  (void)s;
+  return NULL;
+}
+
+WEBUI_API int webui_surface_commit(struct webui_surface *s) {
+  (void)s;
+  return -1;
+}
+
+WEBUI_API void webui_surface_stats(struct webui_surface *s,
+                                   struct webui_surface_stats *stats) {
+  (void)s;
+  memset(stats, 0, sizeof(*stats));
+}
+
+WEBUI_API void webui_surface_free(struct webui_surface *s) { (void)s; }
+
+WEBUI_API int webui_snapshot(struct webui *w, int format, int full_document,
+                             uint8_t **data, size_t *len, int *width,
+                             int *height) {
+  (void)w;
+  (void)format;
+  (void)full_document;
+  (void)width;
+  (void)height;
+  *data = NULL;
+  *len = 0;
+  return -1;
+}
+
+/* Tracing is not recorded on Windows yet */
+WEBUI_API void webui_trace_enable(int capacity) { (void)capacity; }
+
+WEBUI_API int64_t webui_trace_now(void) {
+  LARGE_INTEGER t, f;
+  QueryPerformanceCounter(&t);
+  QueryPerformanceFrequency(&f);
+  return (t.QuadPart / f.QuadPart) * 1000000 +
+         (t.QuadPart % f.QuadPart) * 1000000 / f.QuadPart;
+}
+
+WEBUI_API void webui_trace_add(struct webui *w, const char *cat,
+                               const char *name, int64_t ts, int64_t dur,
+                               int64_t size) {
+  (void)w;
+  (void)cat;
+  (void)name;
+  (void)ts;
+  (void)dur;
+  (void)size;
+}
+
+WEBUI_API int webui_trace_collect_page(struct webui *w) {
+  (void)w;
+  return -1;
+}
+
+WEBUI_API int webui_trace_dump(const char *path) {
+  (void)path;
+  return -1;
+}
+
 WEBUI_API void webui_terminate(struct webui *w) { PostQuitMessage(0); }
 
+/* Dispatches that were posted but never ran are dropped with their context,
+ * the window procedure must not see w once this returns */
 WEBUI_API void webui_exit(struct webui *w) {
-  DestroyWindow(w->priv.hwnd);
+  if (w->priv.hwnd == NULL) {
+    return;
+  }
+  MSG msg;
+  KillTimer(w->priv.hwnd, WEBUI_FRAME_TIMER);
+  w->priv.frame_cb = NULL;
+  while (PeekMessageW(&msg, w->priv.hwnd, WM_WEBUI_DISPATCH, WM_WEBUI_DISPATCH,
+                      PM_REMOVE)) {
+    free((struct webui_dispatch_arg *)msg.lParam);
+    webui_stats_add(w->priv.stats.queue_depth, -1);
+  }
+  if (IsWindow(w->priv.hwnd)) {
+    DestroyWindow(w->priv.hwnd);
+  }
+  UnEmbedBrowserObject(w);
+  w->priv.hwnd = NULL;
   OleUninitialize();
 }
 
 WEBUI_API void webui_print_log(const char *s) { OutputDebugString(s); }
 
+/* MSHTML manages its own caches */
+WEBUI_API void webui_purge_caches(struct webui *w) { (void)w; }
+
+WEBUI_API void webui_clear_data(struct webui *w, int types) {
+  (void)w;
+  (void)types;
+}
+
+/* The window is always shown at once and phases are not tracked */
+WEBUI_API void webui_ready(struct webui *w) { (void)w; }
+
+WEBUI_API void webui_get_startup(struct webui *w,
+                                 struct webui_startup *startup) {
+  (void)w;
+  memset(startup, 0, sizeof(*startup));
+}
+
 WEBUI_API void webui_set_min_size(struct webui *w,int width,int height){
   w->minWidth=width;
   w->minHeight=height;
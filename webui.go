@@ -1,4 +1,3 @@
-//
 // Package webui implements Go bindings to https://github.com/srfirouzi/webui C library.
 //
 // Bindings closely repeat the C APIs and include both, a simplified
@@ -7,7 +6,6 @@
 //
 // The library uses gtk-webkit, Cocoa/Webkit and MSHTML (IE8..11) as a browser
 // engine and supports Linux, Windows 7..10 respectively.
-//
 package webui
 
 /*
@@ -37,13 +35,31 @@ extern void _WebUiExternalInvokeCallback(void *, void *);
 
 extern int _WebUiCloseCallback(void *);
 
+extern void _WebUiFrameCallback(void *, int64_t, int64_t);
+
+extern void _WebUiLoadCallback(void *, int, int64_t, char *, char *);
+
+extern void _WebUiVisibilityCallback(void *, int, int);
+
+extern void _WebUiRecoverCallback(void *, int);
+
+static inline void CgoWebUiSetLoadCallback(void *w) {
+	((struct webui *)w)->load_cb = (webui_load_cb) _WebUiLoadCallback;
+}
+
+static inline void CgoWebUiSetVisibilityCallback(void *w) {
+	((struct webui *)w)->visibility_cb = (webui_visibility_cb) _WebUiVisibilityCallback;
+}
+
 static inline void CgoWebUiFree(void *w) {
 	free((void *)((struct webui *)w)->title);
 	free((void *)((struct webui *)w)->url);
+	free((void *)((struct webui *)w)->data_dir);
+	free((void *)((struct webui *)w)->cache_dir);
 	free(w);
 }
 
-static inline void *CgoWebUiCreate(int width, int height, char *title, char *url, int border, int debug) {
+static inline void *CgoWebUiNew(int width, int height, char *title, char *url, int border, int debug) {
 	struct webui *w = (struct webui *) calloc(1, sizeof(*w));
 	w->width = width;
 	w->height = height;
@@ -53,11 +69,16 @@ static inline void *CgoWebUiCreate(int width, int height, char *title, char *url
 	w->debug = debug;
 	w->external_invoke_cb = (webui_external_invoke_cb_t) _WebUiExternalInvokeCallback;
 	w->close_cb =(webui_close_cb) _WebUiCloseCallback;
-	if (webui_init(w) != 0) {
+	w->recover_cb = (webui_recover_cb) _WebUiRecoverCallback;
+	return (void *)w;
+}
+
+static inline int CgoWebUiInit(void *w) {
+	if (webui_init((struct webui *)w) != 0) {
 		CgoWebUiFree(w);
-		return NULL;
+		return -1;
 	}
-	return (void *)w;
+	return 0;
 }
 
 static inline int CgoWebUiLoop(void *w, int blocking) {
@@ -72,8 +93,28 @@ static inline void CgoWebUiExit(void *w) {
 	webui_exit((struct webui *)w);
 }
 
-static inline void CgoWebUiSetTitle(void *w, char *title) {
-	webui_set_title((struct webui *)w, title);
+static inline void CgoWebUiSetTitle(void *w, char *title, size_t len) {
+	webui_set_title_n((struct webui *)w, title, len);
+}
+
+static inline void CgoWebUiNavigate(void *w, char *url) {
+	webui_navigate((struct webui *)w, url);
+}
+
+static inline void CgoWebUiLoadHTML(void *w, char *html, size_t len, char *base_uri) {
+	webui_load_html((struct webui *)w, html, len, base_uri);
+}
+
+static inline void CgoWebUiPrerender(void *w, char *url) {
+	webui_prerender((struct webui *)w, url);
+}
+
+static inline void CgoWebUiReady(void *w) {
+	webui_ready((struct webui *)w);
+}
+
+static inline void CgoWebUiGetStartup(void *w, struct webui_startup *startup) {
+	webui_get_startup((struct webui *)w, startup);
 }
 
 static inline void CgoWebUiSetFullscreen(void *w, int fullscreen) {
@@ -84,23 +125,87 @@ static inline void CgoWebUiSetColor(void *w, uint8_t r, uint8_t g, uint8_t b, ui
 	webui_set_color((struct webui *)w, r, g, b, a);
 }
 
+static inline void CgoWebUiPurgeCaches(void *w) {
+	webui_purge_caches((struct webui *)w);
+}
+
+static inline void CgoWebUiClearData(void *w, int types) {
+	webui_clear_data((struct webui *)w, types);
+}
+
 static inline void CgoWebUiSetMinSize(void *w,  int width,int height) {
 	webui_set_min_size((struct webui *)w, width, height);
 }
-static inline int CgoWebUiMsg(void *w, int flags,char *title, char *msg){
-	return webui_msg((struct webui *)w,flags, title,msg);
+static inline int CgoWebUiMsg(void *w, int flags, char *title, size_t title_len, char *msg, size_t msg_len) {
+	return webui_msg_n((struct webui *)w, flags, title, title_len, msg, msg_len);
 }
 
 static inline void CgoWebUiFile(void *w, int type,char *filter, char *res, size_t ressz) {
 	webui_file(w, type,(const char*) filter, res, ressz);
 }
 
-static inline int CgoWebUiEval(void *w, char *js) {
-	return webui_eval((struct webui *)w, js);
+static inline int CgoWebUiEval(void *w, char *js, size_t len) {
+	return webui_eval_n((struct webui *)w, js, len);
+}
+
+static inline int CgoWebUiEvalAsync(void *w, char *js, size_t len) {
+	return webui_eval_async((struct webui *)w, js, len);
+}
+
+static inline int CgoWebUiEvalResult(void *w, char *js, size_t len, char **result) {
+	return webui_eval_result_n((struct webui *)w, js, len, result);
+}
+
+static inline int CgoWebUiEvalTimeout(void *w, char *js, size_t len, int timeout, struct webui_cancel *cancel, char **result) {
+	return webui_eval_timeout((struct webui *)w, js, len, timeout, cancel, result);
 }
 
-static inline void CgoWebUiInjectCSS(void *w, char *css) {
-	webui_inject_css((struct webui *)w, css);
+static inline int CgoWebUiWaitReady(void *w, int timeout) {
+	return webui_wait_ready((struct webui *)w, timeout);
+}
+
+static inline int CgoWebUiAddUserScript(void *w, char *js) {
+	return webui_add_user_script((struct webui *)w, js);
+}
+
+static inline int CgoWebUiUseLibrary(void *w, char *name) {
+	return webui_use_library((struct webui *)w, name);
+}
+
+static inline int CgoWebUiStyleAdd(void *w, char *css) {
+	return webui_style_add((struct webui *)w, css);
+}
+
+static inline int CgoWebUiStyleReplace(void *w, int id, char *css, size_t len) {
+	return webui_style_replace_n((struct webui *)w, id, css, len);
+}
+
+static inline int CgoWebUiStyleRemove(void *w, int id) {
+	return webui_style_remove((struct webui *)w, id);
+}
+
+static inline void CgoWebUiInjectCSS(void *w, char *css, size_t len) {
+	webui_inject_css_n((struct webui *)w, css, len);
+}
+
+static inline void CgoWebUiOnFrame(void *w, int enable) {
+	webui_on_frame((struct webui *)w, enable ? (webui_frame_cb) _WebUiFrameCallback : NULL);
+}
+
+static inline void *CgoWebUiSurfaceNew(void *w, char *canvas, int width, int height) {
+	return (void *)webui_surface_new((struct webui *)w, canvas, width, height);
+}
+
+static inline int CgoWebUiSnapshot(void *w, int format, int full, uint8_t **data, size_t *len, int *width, int *height) {
+	return webui_snapshot((struct webui *)w, format, full, data, len, width, height);
+}
+
+static inline void CgoWebUiGetStats(void *w, struct webui_stats *stats) {
+	webui_get_stats((struct webui *)w, stats);
+}
+
+static inline int CgoWebUiTraceCollectPage(void *w) {
+	return webui_trace_collect_page((struct webui *)w);
 }
 
 extern void _WebUiDispatchGoCallback(void *);
@@ -114,14 +219,18 @@ static inline void CgoWebUiDispatch(void *w, uintptr_t arg) {
 import "C"
 import (
 	"bytes"
+	"context"
 	"encoding/json"
 	"errors"
 	"fmt"
 	"html/template"
 	"log"
+	"math"
 	"reflect"
 	"runtime"
 	"sync"
+	"sync/atomic"
+	"time"
 	"unicode"
 	"unsafe"
 )
@@ -141,7 +250,7 @@ const (
 // MessageFlag flag for msg function
 type MessageFlag int
 
-//MessageResponse respond button
+// MessageResponse respond button
 type MessageResponse int
 
 const (
@@ -198,6 +307,70 @@ func Open(title, url string, w, h int, border WindowBorder) error {
 	return nil
 }
 
+// Iterate runs a single iteration of the UI loop shared by all windows and
+// reports whether anything was processed. Blocking waits for an event or a
+// Wakeup(). It must be called from the main thread only.
+func Iterate(blocking bool) bool {
+	return C.webui_iterate(C.int(boolToInt(blocking))) != 0
+}
+
+// Wakeup makes a blocking Iterate() return. It is safe to call from any
+// goroutine.
+func Wakeup() {
+	C.webui_wakeup()
+}
+
+// RegisterLibrary registers a JS library, e.g. a UI framework, under a name
+// so windows can load it with UseLibrary(). The source is copied once and
+// shared by all windows, registering a name again keeps the first source.
+// It must be called from the main thread only.
+func RegisterLibrary(name, js string) {
+	n, p := C.CString(name), C.CString(js)
+	defer C.free(unsafe.Pointer(n))
+	defer C.free(unsafe.Pointer(p))
+	C.webui_register_library(n, p)
+}
+
+// EnableTrace starts recording eval, invoke, dispatch and page load spans
+// of all windows into a buffer that keeps the last capacity events (Linux/BSD
+// only). A capacity of 0 stops tracing and drops the recorded events.
+func EnableTrace(capacity int) {
+	C.webui_trace_enable(C.int(capacity))
+	tracing.Store(capacity > 0)
+}
+
+var (
+	tracing   atomic.Bool
+	traceCat  = C.CString("go")
+	traceNoop = func() {}
+)
+
+// Trace starts a Go span with the given name and returns the function that
+// ends it, typically used as defer webui.Trace("load model")(). It is safe
+// to call from any goroutine and does not allocate while tracing is off.
+func Trace(name string) func() {
+	if !tracing.Load() {
+		return traceNoop
+	}
+	start := C.webui_trace_now()
+	return func() {
+		n := C.CString(name)
+		defer C.free(unsafe.Pointer(n))
+		C.webui_trace_add(nil, traceCat, n, start, C.webui_trace_now()-start, 0)
+	}
+}
+
+// DumpTrace writes the recorded spans to a file in the Chrome Trace Event
+// format, to be opened with chrome://tracing or https://ui.perfetto.dev.
+func DumpTrace(path string) error {
+	p := C.CString(path)
+	defer C.free(unsafe.Pointer(p))
+	if C.webui_trace_dump(p) != 0 {
+		return errors.New("failed to write trace to " + path)
+	}
+	return nil
+}
+
 // Debug prints a debug string using stderr on Linux/BSD
 // OutputDebugString on Windows.
 func Debug(a ...interface{}) {
@@ -213,6 +386,195 @@ func Debugf(format string, a ...interface{}) {
 	C.webui_print_log(s)
 }
 
+// CacheModel selects how aggressively WebKit caches resources
+type CacheModel int
+
+const (
+	// CacheDefault keeps the WebKit default cache model
+	CacheDefault CacheModel = C.WEBUI_CACHE_DEFAULT
+	// CacheDocumentViewer disables the memory cache, smallest footprint
+	CacheDocumentViewer CacheModel = C.WEBUI_CACHE_DOCUMENT_VIEWER
+	// CacheDocumentBrowser uses a small memory cache
+	CacheDocumentBrowser CacheModel = C.WEBUI_CACHE_DOCUMENT_BROWSER
+	// CacheWebBrowser uses large memory and disk caches
+	CacheWebBrowser CacheModel = C.WEBUI_CACHE_WEB_BROWSER
+)
+
+// ProcessModel selects how web views are mapped to web processes
+type ProcessModel int
+
+const (
+	// ProcessDefault keeps the WebKit default process model
+	ProcessDefault ProcessModel = C.WEBUI_PROCESS_DEFAULT
+	// ProcessShared runs all windows in one web process
+	ProcessShared ProcessModel = C.WEBUI_PROCESS_SHARED
+	// ProcessPerView runs each window in its own web process
+	ProcessPerView ProcessModel = C.WEBUI_PROCESS_PER_VIEW
+)
+
+// Feature is a set of optional WebKit features that can be switched off
+type Feature uint
+
+const (
+	// FeaturePlugins is NPAPI plugins and Java
+	FeaturePlugins Feature = C.WEBUI_FEATURE_PLUGINS
+	// FeatureSpellChecking is spell checking of editable fields. It is a
+	// setting of the engine shared by all windows of the process, switching
+	// it off for one window switches it off for every window.
+	FeatureSpellChecking Feature = C.WEBUI_FEATURE_SPELL_CHECKING
+	// FeaturePageCache is the back/forward page cache
+	FeaturePageCache Feature = C.WEBUI_FEATURE_PAGE_CACHE
+	// FeatureSmoothScrolling is animated scrolling
+	FeatureSmoothScrolling Feature = C.WEBUI_FEATURE_SMOOTH_SCROLLING
+	// FeatureWebGL is the WebGL canvas context
+	FeatureWebGL Feature = C.WEBUI_FEATURE_WEBGL
+	// FeatureMediaSource is the Media Source Extensions API
+	FeatureMediaSource Feature = C.WEBUI_FEATURE_MEDIA_SOURCE
+	// FeatureFavicons is the favicon database, shared by all windows of the
+	// process like FeatureSpellChecking
+	FeatureFavicons Feature = C.WEBUI_FEATURE_FAVICONS
+	// FeatureModalDialogs is alert(), confirm() and prompt()
+	FeatureModalDialogs Feature = C.WEBUI_FEATURE_MODAL_DIALOGS
+
+	// LeanProfile switches off every optional feature
+	LeanProfile Feature = C.WEBUI_PROFILE_LEAN
+)
+
+// DataType is a set of website data kinds for ClearData()
+type DataType int
+
+const (
+	// DataCache is the memory and disk HTTP cache
+	DataCache DataType = C.WEBUI_DATA_CACHE
+	// DataStorage is localStorage, sessionStorage and IndexedDB
+	DataStorage DataType = C.WEBUI_DATA_STORAGE
+	// DataCookies is the cookie jar
+	DataCookies DataType = C.WEBUI_DATA_COOKIES
+	// DataAll is every kind of website data
+	DataAll DataType = C.WEBUI_DATA_ALL
+)
+
+// ShowMode selects when a new window becomes visible
+type ShowMode int
+
+const (
+	// ShowImmediate shows the window right away
+	ShowImmediate ShowMode = C.WEBUI_SHOW_IMMEDIATE
+	// ShowOnCommit shows the window once the first page content is committed
+	ShowOnCommit ShowMode = C.WEBUI_SHOW_ON_COMMIT
+	// ShowOnLoad shows the window once the page has finished loading
+	ShowOnLoad ShowMode = C.WEBUI_SHOW_ON_LOAD
+	// ShowOnReady shows the window when Ready() or window.external.ready()
+	// is called
+	ShowOnReady ShowMode = C.WEBUI_SHOW_ON_READY
+)
+
+// SnapshotFormat is the encoding of Snapshot() data
+type SnapshotFormat int
+
+const (
+	// SnapshotRGBA is raw RGBA pixels, 4 bytes per pixel, rows not padded
+	SnapshotRGBA SnapshotFormat = C.WEBUI_SNAPSHOT_RGBA
+	// SnapshotPNG is a PNG image
+	SnapshotPNG SnapshotFormat = C.WEBUI_SNAPSHOT_PNG
+)
+
+// StartupTimes holds when each startup phase was reached, measured from the
+// window creation. A phase that has not been reached yet is 0.
+type StartupTimes struct {
+	Committed time.Duration
+	Finished  time.Duration
+	Ready     time.Duration
+	Shown     time.Duration
+}
+
+// Histogram counts latencies in log-linear microsecond buckets like
+// HdrHistogram: below 8us every microsecond has its own bucket, above that
+// each power of two is split into 8 linear sub-buckets, so a bucket is at
+// most 12.5% wide. The last bucket also holds everything above.
+type Histogram [C.WEBUI_HISTOGRAM_BUCKETS]uint64
+
+// Count returns the number of recorded latencies
+func (h *Histogram) Count() (n uint64) {
+	for _, c := range h {
+		n += c
+	}
+	return n
+}
+
+// Quantile returns the upper bound of the bucket holding the q quantile,
+// e.g. 0.99 for p99, or 0 when nothing was recorded.
+func (h *Histogram) Quantile(q float64) time.Duration {
+	total := h.Count()
+	if total == 0 {
+		return 0
+	}
+	rank := uint64(math.Ceil(q * float64(total)))
+	var n uint64
+	for i, c := range h {
+		n += c
+		if n >= rank && c > 0 {
+			return histogramBound(i)
+		}
+	}
+	return histogramBound(len(h) - 1)
+}
+
+// histogramBound returns the exclusive upper bound of bucket i
+func histogramBound(i int) time.Duration {
+	const sub = 1 << C.WEBUI_HISTOGRAM_SUB_BITS
+	if i < sub {
+		return time.Duration(i+1) * time.Microsecond
+	}
+	shift := uint((i - sub) / sub)
+	low := uint64(sub+(i-sub)%sub) << shift
+	return time.Duration(low+uint64(1)<<shift) * time.Microsecond
+}
+
+// Stats are cumulative counters of a window since it was created
+type Stats struct {
+	Evals         uint64
+	Invokes       uint64
+	Dispatches    uint64
+	BytesToPage   uint64 // JS code sent with Eval()
+	BytesFromPage uint64 // invoke messages
+	QueueDepth    int    // dispatched functions waiting to run
+	EvalsInFlight int
+	// EvalLatency is the time Eval() calls take to complete
+	EvalLatency Histogram
+	// InvokeLatency is the time spent in the invoke callback
+	InvokeLatency Histogram
+	// DispatchLatency is the time dispatched functions wait before they run
+	DispatchLatency Histogram
+	// With Settings.InputLatency: presses and scrolls, the time from each
+	// until the page painted the frame after it, with the changes made by
+	// its handlers, and to the first invoke it triggered
+	Inputs         uint64
+	InputToPaint   Histogram
+	InputToHandler Histogram
+	// Time the window was visible and hidden, and the CPU time used by the
+	// UI process (not the web process) in each state
+	VisibleTime time.Duration
+	HiddenTime  time.Duration
+	CPUVisible  time.Duration
+	CPUHidden   time.Duration
+	// Evals queued while the window was hidden, with Settings.ThrottleHidden
+	DeferredEvals uint64
+	// Evals given up on after their timeout, and cancelled by EvalContext()
+	EvalTimeouts uint64
+	EvalCancels  uint64
+}
+
+// CPUSaved estimates the CPU time saved while the window was hidden, from
+// the CPU usage rate while it was visible
+func (s Stats) CPUSaved() time.Duration {
+	if s.VisibleTime <= 0 {
+		return 0
+	}
+	rate := float64(s.CPUVisible) / float64(s.VisibleTime)
+	return time.Duration(rate*float64(s.HiddenTime)) - s.CPUHidden
+}
+
 // ExternalInvokeCallbackFunc is a function type that is called every time
 // "window.external.invoke()" is called from JavaScript. Data is the only
 // obligatory string parameter passed into the "invoke(data)" function from
@@ -220,9 +582,261 @@ func Debugf(format string, a ...interface{}) {
 // string can be used.
 type ExternalInvokeCallbackFunc func(w WebUI, data string)
 
-//CloseCallbackFunc is function type for callback in user can close the windows
+// CloseCallbackFunc is function type for callback in user can close the windows
 type CloseCallbackFunc func(w WebUI) bool
 
+// LoadEventType is the phase of a page load reported to LoadCallbackFunc
+type LoadEventType int
+
+const (
+	// LoadStarted is reported when a new page starts loading
+	LoadStarted LoadEventType = C.WEBUI_LOAD_STARTED
+	// LoadRedirected is reported when the server redirected the request,
+	// URI is the new address
+	LoadRedirected LoadEventType = C.WEBUI_LOAD_REDIRECTED
+	// LoadCommitted is reported when the first data of the new page arrived
+	// and it replaced the old one
+	LoadCommitted LoadEventType = C.WEBUI_LOAD_COMMITTED
+	// LoadFinished is reported when the page and its resources are loaded
+	LoadFinished LoadEventType = C.WEBUI_LOAD_FINISHED
+	// LoadFailed is reported before LoadFinished when the load failed, with
+	// the reason in Error
+	LoadFailed LoadEventType = C.WEBUI_LOAD_FAILED
+	// LoadTiming follows LoadFinished with the page's timing entries
+	LoadTiming LoadEventType = C.WEBUI_LOAD_TIMING
+)
+
+// LoadEvent describes a step of a page load
+type LoadEvent struct {
+	Type LoadEventType
+	// Time since the window was created
+	Time time.Duration
+	URI  string
+	// Error message of LoadFailed
+	Error string
+	// JSON object of LoadTiming with the page's timeOrigin and its
+	// Navigation Timing ("navigation") and Resource Timing ("resource")
+	// entries
+	Timing json.RawMessage
+}
+
+// LoadCallbackFunc is called on the main thread for each step of a page
+// load of the window (Linux/BSD only)
+type LoadCallbackFunc func(w WebUI, e LoadEvent)
+
+// RecoverReason tells why the page was reloaded in a new web process
+type RecoverReason int
+
+const (
+	// RecoverCrashed is reported when the web process crashed
+	RecoverCrashed RecoverReason = C.WEBUI_RECOVER_CRASHED
+	// RecoverOutOfMemory is reported when the web process was terminated
+	// for exceeding its memory limit
+	RecoverOutOfMemory RecoverReason = C.WEBUI_RECOVER_OUT_OF_MEMORY
+	// RecoverUnresponsive is reported when the web process was killed after
+	// Settings.HangTimeout
+	RecoverUnresponsive RecoverReason = C.WEBUI_RECOVER_UNRESPONSIVE
+)
+
+// RecoverCallbackFunc is called on the main thread once the page has been
+// reloaded after its web process went away (Linux/BSD only). Bind() objects
+// and user scripts are already restored, anything else injected with Eval()
+// has to be injected again.
+type RecoverCallbackFunc func(w WebUI, reason RecoverReason)
+
+// ErrEvalTimeout is returned by Eval() and EvalResult() when the page did not
+// finish the script within Settings.EvalTimeout, and by EvalContext() when
+// the deadline of its context passed
+var ErrEvalTimeout = errors.New("evaluation timed out")
+
+// ErrEvalCancelled is returned when an eval was cancelled before the page
+// finished it
+var ErrEvalCancelled = errors.New("evaluation cancelled")
+
+// VisibilityCallbackFunc is called on the main thread when the window is
+// minimized, restored, hidden or shown, or gains or loses focus (Linux/BSD
+// only)
+type VisibilityCallbackFunc func(w WebUI, visible, focused bool)
+
+// FrameCallbackFunc is called once per frame of the window's frame clock,
+// aligned to the display refresh. FrameTime is the monotonic time the frame
+// will be presented at and frame is the frame counter.
+type FrameCallbackFunc func(w WebUI, frameTime time.Duration, frame int64)
+
+// SurfaceStats are the counters of a Surface
+type SurfaceStats struct {
+	// Frames committed by native code
+	Committed uint64
+	// Frames handed over to the page
+	Presented uint64
+	// Frames dropped because the page was still busy with an older one
+	Dropped uint64
+	// Time from Commit() to the hand-over to the page
+	LatencyLast time.Duration
+	LatencyAvg  time.Duration
+	LatencyMax  time.Duration
+}
+
+// Surface streams RGBA frames from native code into a <canvas> element.
+// Draw into Pixels() and call Commit() to show the frame. Frames are handed
+// to the page without base64 encoding or a copy. Linux/BSD only. The surface
+// is gone after Close() or the Exit() of its window, Pixels() then returns
+// nil and Commit() false. The page fetches frames on the main thread, so
+// draw, Commit() and Close() on the main thread too, from other goroutines
+// go through Dispatch().
+type Surface struct {
+	s      *C.struct_webui_surface
+	w      *webui
+	width  int
+	height int
+}
+
+// Pixels returns the back buffer, width*height*4 bytes of RGBA. The slice is
+// only valid until the next Commit().
+func (s *Surface) Pixels() []byte {
+	if s.s == nil {
+		return nil
+	}
+	p := C.webui_surface_pixels(s.s)
+	return unsafe.Slice((*byte)(unsafe.Pointer(p)), s.width*s.height*4)
+}
+
+// Commit shows the back buffer. It returns false if the frame was dropped
+// because the previous one is still being sent to the page, the back buffer
+// is then kept and can be committed again. It must be called from the main
+// thread only.
+func (s *Surface) Commit() bool {
+	if s.s == nil {
+		return false
+	}
+	return C.webui_surface_commit(s.s) == 0
+}
+
+// Stats returns the frame and latency counters of the surface.
+func (s *Surface) Stats() SurfaceStats {
+	var st C.struct_webui_surface_stats
+	if s.s == nil {
+		return SurfaceStats{}
+	}
+	C.webui_surface_stats(s.s, &st)
+	return SurfaceStats{
+		Committed:   uint64(st.committed),
+		Presented:   uint64(st.presented),
+		Dropped:     uint64(st.dropped),
+		LatencyLast: time.Duration(st.latency_last) * time.Microsecond,
+		LatencyAvg:  time.Duration(st.latency_avg) * time.Microsecond,
+		LatencyMax:  time.Duration(st.latency_max) * time.Microsecond,
+	}
+}
+
+// Close stops the stream and frees the buffers. Calling it again, or after
+// the window's Exit(), does nothing.
+func (s *Surface) Close() {
+	m.Lock()
+	p := s.s
+	s.s = nil
+	delete(s.w.surfaces, s)
+	m.Unlock()
+	if p != nil {
+		C.webui_surface_free(p)
+	}
+}
+
+// Batch records commands for a window and runs them all, in order, with a
+// single call into C. A batch can be reused after Run().
+type Batch struct {
+	w       *webui
+	buf     []byte
+	ops     []C.int
+	results []C.int
+}
+
+func (b *Batch) add(op, arg uint32, s string) *Batch {
+	n := uint32(len(s))
+	b.buf = append(b.buf, byte(op), byte(op>>8), byte(op>>16), byte(op>>24),
+		byte(arg), byte(arg>>8), byte(arg>>16), byte(arg>>24),
+		byte(n), byte(n>>8), byte(n>>16), byte(n>>24))
+	b.buf = append(b.buf, s...)
+	b.ops = append(b.ops, C.int(op))
+	return b
+}
+
+// Eval records WebUI.Eval()
+func (b *Batch) Eval(js string) *Batch {
+	return b.add(C.WEBUI_BATCH_EVAL, 0, js)
+}
+
+// InjectCSS records WebUI.InjectCSS()
+func (b *Batch) InjectCSS(css string) *Batch {
+	return b.add(C.WEBUI_BATCH_INJECT_CSS, 0, css)
+}
+
+// SetTitle records WebUI.SetTitle()
+func (b *Batch) SetTitle(title string) *Batch {
+	return b.add(C.WEBUI_BATCH_SET_TITLE, 0, title)
+}
+
+// SetColor records WebUI.SetColor()
+func (b *Batch) SetColor(r, g, bl, a uint8) *Batch {
+	return b.add(C.WEBUI_BATCH_SET_COLOR,
+		uint32(r)<<24|uint32(g)<<16|uint32(bl)<<8|uint32(a), "")
+}
+
+// SetFullscreen records WebUI.SetFullscreen()
+func (b *Batch) SetFullscreen(fullscreen bool) *Batch {
+	return b.add(C.WEBUI_BATCH_SET_FULLSCREEN, uint32(boolToInt(fullscreen)), "")
+}
+
+// ReplaceStyle records WebUI.ReplaceStyle()
+func (b *Batch) ReplaceStyle(id int, css string) *Batch {
+	return b.add(C.WEBUI_BATCH_STYLE_REPLACE, uint32(id), css)
+}
+
+// Len returns the number of recorded commands.
+func (b *Batch) Len() int {
+	return len(b.ops)
+}
+
+// Run executes the recorded commands and clears the batch. It returns one
+// error per command, nil for the ones that succeeded. It must be called from
+// the main thread only, use Dispatch() to run a batch from a goroutine.
+// Commands recorded by callbacks while Run() is in progress go into a new
+// batch, they run with the next Run().
+func (b *Batch) Run() []error {
+	if len(b.ops) == 0 {
+		return nil
+	}
+	// Detached while C reads them, evals run nested loops that may call
+	// back into Go and record into b
+	buf, ops, results := b.buf, b.ops, b.results
+	b.buf, b.ops, b.results = nil, nil, nil
+	if cap(results) < len(ops) {
+		results = make([]C.int, len(ops))
+	}
+	results = results[:len(ops)]
+	// buf is on the heap, which does not move, so C can borrow it even
+	// when a command calls back into Go
+	n := C.webui_batch_exec((*C.struct_webui)(b.w.w), (*C.char)(unsafe.Pointer(&buf[0])),
+		C.size_t(len(buf)), &results[0], C.int(len(results)))
+	runtime.KeepAlive(buf)
+	errs := make([]error, len(ops))
+	for i, op := range ops {
+		switch {
+		case n < 0:
+			errs[i] = errors.New("malformed batch")
+		case results[i] == 0:
+		case op == C.WEBUI_BATCH_EVAL:
+			errs[i] = evalError(results[i])
+		default:
+			errs[i] = fmt.Errorf("batch command %d failed", i)
+		}
+	}
+	if b.ops == nil {
+		b.buf, b.ops, b.results = buf[:0], ops[:0], results
+	}
+	return errs
+}
+
 // Settings is a set of parameters to customize the initial WebUI appearance
 // and behavior. It is passed into the webui.New() constructor.
 type Settings struct {
@@ -230,6 +844,12 @@ type Settings struct {
 	Title string
 	// URL to open in a webui
 	URL string
+	// HTML to load instead of the URL. It is passed to the engine without
+	// URL encoding, so it can hold a whole single-file app of any size.
+	HTML string
+	// BaseURI resolves the relative URLs of HTML, e.g. to load its assets
+	// from a server or a custom scheme (Linux/BSD only)
+	BaseURI string
 	// Window width in pixels
 	Width int
 	// Window height in pixels
@@ -238,10 +858,68 @@ type Settings struct {
 	Border WindowBorder
 	// Enable debugging tools (Linux/BSD, on Windows use Firebug)
 	Debug bool
+	// Web process tuning (Linux/BSD). It is shared by all windows and only
+	// the settings of the first window are used.
+	CacheModel   CacheModel
+	ProcessModel ProcessModel
+	// Web process memory limit in MB, 0 keeps the WebKit default. The
+	// memory settings need their own website data manager: unless DataDir
+	// and CacheDir are set too, WebKit picks the storage directories and
+	// cookies, localStorage and the cache may live elsewhere than without
+	// them.
+	MemoryLimit int
+	// Fractions of MemoryLimit at which WebKit starts releasing memory
+	// conservatively, strictly, and kills the web process. 0 keeps the
+	// WebKit defaults.
+	MemoryConservativeThreshold float64
+	MemoryStrictThreshold       float64
+	MemoryKillThreshold         float64
+	// Features switched off before the first page load (Linux/BSD), use
+	// LeanProfile for minimal memory and startup time
+	DisabledFeatures Feature
+	// Directories for localStorage/IndexedDB and for the HTTP disk cache
+	// (Linux/BSD). Empty keeps the WebKit defaults. Shared by all windows,
+	// only the first window's values are used.
+	DataDir  string
+	CacheDir string
+	// Startup purge threshold of CacheDir in MB: when the directory is
+	// larger at startup the whole disk cache is cleared once. It is not a
+	// size cap, the cache can grow beyond it while the app runs. 0 never
+	// purges.
+	CachePurgeSize int
+	// When to make the window visible (Linux/BSD). Anything but ShowImmediate
+	// avoids the white flash of an empty page.
+	ShowMode ShowMode
+	// Show the window anyway after this long, 0 is 3 seconds
+	ShowTimeout time.Duration
+	// Render into an offscreen window that is never shown on screen, for
+	// reports, thumbnails and UI tests. A display is still needed, Xvfb or
+	// Broadway work in CI.
+	Offscreen bool
+	// Measure input-to-paint and input-to-handler latency into Stats()
+	// (Linux/BSD), a diagnostic mode for laggy UIs
+	InputLatency bool
+	// While the window is minimized or hidden, suspend the frame callback and
+	// defer Eval() and Bind() syncs until it is visible again (Linux/BSD).
+	// Only the latest sync of each binding is kept.
+	ThrottleHidden bool
+	// Give up waiting for Eval() after this long, 0 waits forever (Linux/BSD)
+	EvalTimeout time.Duration
+	// Kill and reload a web process that stays unresponsive this long, 0
+	// never does (Linux/BSD). It needs WebKit 2.34 or newer, older versions
+	// ignore it and log a warning. Crashed web processes are always
+	// reloaded.
+	HangTimeout time.Duration
 	// A callback that is executed when JavaScript calls "window.external.invoke()"
 	ExternalInvokeCallback ExternalInvokeCallbackFunc
 	// A callback for windows close event
 	CloseCallback CloseCallbackFunc
+	// A callback for page load events
+	LoadCallback LoadCallbackFunc
+	// A callback for visibility and focus changes
+	VisibilityCallback VisibilityCallbackFunc
+	// A callback for a page reloaded after a crashed or killed web process
+	RecoverCallback RecoverCallbackFunc
 }
 
 // WebUI is an interface that wraps the basic methods for controlling the UI
@@ -255,6 +933,28 @@ type WebUI interface {
 	// SetTitle() changes window title. This method must be called from the main
 	// thread only. See Dispatch() for more details.
 	SetTitle(title string)
+	// Navigate() switches the webui to the given URL. A page prepared with
+	// Prerender() is swapped in without reloading, and the current page is
+	// kept alive so that navigating back to it is instant. This method must be
+	// called from the main thread only.
+	Navigate(url string)
+	// LoadHTML() loads the given HTML like Settings.HTML, baseURI resolves
+	// its relative URLs (Linux/BSD only). This method must be called from
+	// the main thread only.
+	LoadHTML(html, baseURI string)
+	// Prerender() loads the given URL in an off-screen view attached to the
+	// window, so a later Navigate() to it only swaps views. A few recently used
+	// pages are kept alive (Linux/BSD only). This method must be called from
+	// the main thread only.
+	Prerender(url string)
+	// Ready() marks the page as ready and shows a window created with
+	// ShowOnReady. Pages can do the same with window.external.ready().
+	Ready()
+	// StartupTimes() reports how long each startup phase took
+	StartupTimes() StartupTimes
+	// Stats() returns the IPC counters and latency histograms of the window.
+	// It is safe to call from any goroutine.
+	Stats() Stats
 	// SetFullscreen() controls window full-screen mode. This method must be
 	// called from the main thread only. See Dispatch() for more details.
 	SetFullscreen(fullscreen bool)
@@ -264,13 +964,58 @@ type WebUI interface {
 	// SetMinSize() set min size for window
 	// called from the main thread only
 	SetMinSize(width int, height int)
+	// PurgeCaches() drops the in-memory resource caches and collects
+	// JavaScript garbage right away. This method must be called from the main
+	// thread only.
+	PurgeCaches()
+	// ClearData() removes the given kinds of website data from memory and
+	// disk. This method must be called from the main thread only.
+	ClearData(types DataType)
 	// Eval() evaluates an arbitrary JS code inside the webui. This method must
 	// be called from the main thread only. See Dispatch() for more details.
 	Eval(js string) error
+	// EvalAsync() sends JS code to the page and returns without waiting for
+	// it to run, so it fits OnFrame() callbacks. Errors in the script are not
+	// reported, an error is only returned while the page is not loaded yet.
+	// This method must be called from the main thread only.
+	EvalAsync(js string) error
+	// EvalResult() evaluates JS code like Eval() and returns the value of its
+	// last expression as JSON (Linux/BSD only). An exception is returned as
+	// an error, a script running past Settings.EvalTimeout as ErrEvalTimeout.
+	// This method must be called from the main thread only.
+	EvalResult(js string) (string, error)
+	// EvalContext() evaluates JS code like Eval() but stops waiting for it
+	// when ctx is done. The request is cancelled in the engine, the script
+	// may have run partly. It returns ErrEvalTimeout when the deadline of
+	// ctx passes and ctx.Err() when ctx is cancelled. Settings.EvalTimeout
+	// does not apply and the script runs even while the window is hidden.
+	// The wait can only be cut short on Linux/BSD. This method must be called
+	// from the main thread only.
+	EvalContext(ctx context.Context, js string) error
+	// WaitReady() runs the UI loop until the page has finished loading or
+	// the timeout expires, 0 waits forever. This method must be called from
+	// the main thread only.
+	WaitReady(timeout time.Duration) error
 	// InjectJS() injects an arbitrary block of CSS code using the JS API. This
 	// method must be called from the main thread only. See Dispatch() for more
 	// details.
 	InjectCSS(css string)
+	// AddStyle() adds a style sheet to the current page and every page loaded
+	// later and returns its id (only the current page on Windows).
+	// ReplaceStyle() swaps the rules of a style sheet and RemoveStyle()
+	// removes it. These methods must be called from the main thread only.
+	AddStyle(css string) (id int, err error)
+	ReplaceStyle(id int, css string) error
+	RemoveStyle(id int) error
+	// AddUserScript() runs JS code at the start of every page loaded later,
+	// before the page's own scripts, and once right away in the current page
+	// and the prerendered screens (only the current page on Windows). This
+	// method must be called from the main thread only.
+	AddUserScript(js string)
+	// UseLibrary() loads a library registered with RegisterLibrary() into
+	// the current page and every page loaded later, like AddUserScript().
+	// This method must be called from the main thread only.
+	UseLibrary(name string) error
 	// Message() open message box and return button click by user
 	Message(title string, msg string, flags MessageFlag) MessageResponse
 	// FileOpen() open file open dialog and response selected file
@@ -287,8 +1032,30 @@ type WebUI interface {
 	// background threads/goroutines, or to terminate the app.
 	Dispatch(func())
 	// Exit() closes the window and cleans up the resources. Use Terminate() to
-	// forcefully break out of the main UI loop.
+	// forcefully break out of the main UI loop. It must be called from the
+	// main thread outside of any callback, usually once Run() returns.
+	// Dispatched functions that have not run yet are dropped, and no other
+	// method may be called afterwards. Calling Exit() again does nothing.
 	Exit()
+	// OnFrame() registers a callback that runs on the main thread once per
+	// display frame, so native code can push each frame's state to the page
+	// in a single Eval() without a JavaScript round trip. Pass nil to stop.
+	OnFrame(f FrameCallbackFunc)
+	// Snapshot() waits for the page to load and renders the visible area, or
+	// the whole document when fullDocument is set. It returns the image data
+	// and its size in pixels (Linux/BSD only). This method must be called
+	// from the main thread only.
+	Snapshot(format SnapshotFormat, fullDocument bool) (data []byte, width, height int, err error)
+	// CollectTrace() moves performance.mark() and performance.measure()
+	// entries from the page into the trace timeline. This method must be
+	// called from the main thread only.
+	CollectTrace() error
+	// NewSurface() attaches a native framebuffer of the given size to the
+	// <canvas> element with the given id. This method and the methods of
+	// the Surface must be called from the main thread only.
+	NewSurface(canvasID string, width, height int) (*Surface, error)
+	// NewBatch() returns an empty Batch of commands for this window.
+	NewBatch() *Batch
 	// Bind() registers a binding between a given value and a JavaScript object with the
 	// given name.  A value must be a struct or a struct pointer. All methods are
 	// available under their camel-case names, starting with a lower-case letter,
@@ -301,17 +1068,51 @@ type WebUI interface {
 var (
 	m     sync.Mutex
 	index uintptr
-	fns   = map[uintptr]func(){}
+	fns   = map[uintptr]dispatchFunc{}
 	cbei  = map[WebUI]ExternalInvokeCallbackFunc{}
 	cbc   = map[WebUI]CloseCallbackFunc{}
+	cbf   = map[WebUI]FrameCallbackFunc{}
+	cbl   = map[WebUI]LoadCallbackFunc{}
+	cbv   = map[WebUI]VisibilityCallbackFunc{}
+	cbr   = map[WebUI]RecoverCallbackFunc{}
 )
 
+// dispatchFunc remembers the window so that Exit() can drop the functions
+// that will never run
+type dispatchFunc struct {
+	w *webui
+	f func()
+}
+
 type webui struct {
 	w unsafe.Pointer
+	// Bind() syncs deferred while the window is hidden, guarded by m
+	throttle bool
+	hidden   bool
+	pending  map[string]func()
+	// Bind() syncs to restore the state after a web process crash, guarded
+	// by m
+	syncs []func()
+	// open surfaces, freed by webui_exit() with the window, guarded by m
+	surfaces map[*Surface]struct{}
 }
 
 var _ WebUI = &webui{}
 
+// emptyCString stands in for empty strings, C needs a valid pointer
+var emptyCString = C.CString("")
+
+// borrowCString returns the bytes of s and their length for the C calls that
+// take one, without copying them. The C side must be done with them when the
+// call returns or before it can call back into Go.
+func borrowCString(s string) (*C.char, C.size_t) {
+	if len(s) == 0 {
+		return emptyCString, 0
+	}
+	h := (*reflect.StringHeader)(unsafe.Pointer(&s))
+	return (*C.char)(unsafe.Pointer(h.Data)), C.size_t(len(s))
+}
+
 func boolToInt(b bool) int {
 	if b {
 		return 1
@@ -333,9 +1134,53 @@ func New(settings Settings) WebUI {
 		settings.Title = "WebUI"
 	}
 	w := &webui{}
-	w.w = C.CgoWebUiCreate(C.int(settings.Width), C.int(settings.Height),
+	cw := (*C.struct_webui)(C.CgoWebUiNew(C.int(settings.Width), C.int(settings.Height),
 		C.CString(settings.Title), C.CString(settings.URL),
-		C.int(settings.Border), C.int(boolToInt(settings.Debug)))
+		C.int(settings.Border), C.int(boolToInt(settings.Debug))))
+	cw.cache_model = C.int(settings.CacheModel)
+	cw.process_model = C.int(settings.ProcessModel)
+	cw.memory_limit = C.int(settings.MemoryLimit)
+	cw.memory_conservative_threshold = C.double(settings.MemoryConservativeThreshold)
+	cw.memory_strict_threshold = C.double(settings.MemoryStrictThreshold)
+	cw.memory_kill_threshold = C.double(settings.MemoryKillThreshold)
+	cw.disabled_features = C.uint(settings.DisabledFeatures)
+	if settings.DataDir != "" {
+		cw.data_dir = C.CString(settings.DataDir)
+	}
+	if settings.CacheDir != "" {
+		cw.cache_dir = C.CString(settings.CacheDir)
+	}
+	cw.cache_purge = C.int(settings.CachePurgeSize)
+	cw.show_mode = C.int(settings.ShowMode)
+	cw.show_timeout = C.int(settings.ShowTimeout / time.Millisecond)
+	cw.offscreen = C.int(boolToInt(settings.Offscreen))
+	cw.input_latency = C.int(boolToInt(settings.InputLatency))
+	cw.throttle_hidden = C.int(boolToInt(settings.ThrottleHidden))
+	cw.eval_timeout = C.int(settings.EvalTimeout / time.Millisecond)
+	cw.hang_timeout = C.int(settings.HangTimeout / time.Millisecond)
+	if settings.HTML != "" {
+		cw.html = C.CString(settings.HTML)
+		cw.html_len = C.size_t(len(settings.HTML))
+		if settings.BaseURI != "" {
+			cw.base_uri = C.CString(settings.BaseURI)
+		}
+	}
+	w.throttle = settings.ThrottleHidden
+	if settings.LoadCallback != nil {
+		C.CgoWebUiSetLoadCallback(unsafe.Pointer(cw))
+	}
+	if settings.VisibilityCallback != nil || settings.ThrottleHidden {
+		C.CgoWebUiSetVisibilityCallback(unsafe.Pointer(cw))
+	}
+	// The engine has its own copy of the HTML once it is loaded, cw itself
+	// is gone if the init fails
+	html, baseURI := cw.html, cw.base_uri
+	if C.CgoWebUiInit(unsafe.Pointer(cw)) == 0 {
+		w.w = unsafe.Pointer(cw)
+		cw.html, cw.base_uri = nil, nil
+	}
+	C.free(unsafe.Pointer(html))
+	C.free(unsafe.Pointer(baseURI))
 	m.Lock()
 	if settings.ExternalInvokeCallback != nil {
 		cbei[w] = settings.ExternalInvokeCallback
@@ -347,6 +1192,15 @@ func New(settings Settings) WebUI {
 	} else {
 		cbc[w] = func(w WebUI) bool { return true }
 	}
+	if settings.LoadCallback != nil {
+		cbl[w] = settings.LoadCallback
+	}
+	if settings.VisibilityCallback != nil {
+		cbv[w] = settings.VisibilityCallback
+	}
+	if settings.RecoverCallback != nil {
+		cbr[w] = settings.RecoverCallback
+	}
 	m.Unlock()
 	return w
 }
@@ -365,22 +1219,75 @@ func (w *webui) Run() {
 }
 
 func (w *webui) Exit() {
-	C.CgoWebUiExit(w.w)
+	m.Lock()
+	p := w.w
+	w.w = nil
+	delete(cbei, w)
+	delete(cbc, w)
+	delete(cbf, w)
+	delete(cbl, w)
+	delete(cbv, w)
+	delete(cbr, w)
+	for k, d := range fns {
+		if d.w == w {
+			delete(fns, k)
+		}
+	}
+	w.pending = nil
+	w.syncs = nil
+	for s := range w.surfaces {
+		s.s = nil
+	}
+	w.surfaces = nil
+	m.Unlock()
+	if p != nil {
+		C.CgoWebUiExit(p)
+		C.CgoWebUiFree(p)
+	}
 }
 
 func (w *webui) Dispatch(f func()) {
 	m.Lock()
-	for ; fns[index] != nil; index++ {
+	defer m.Unlock()
+	if w.w == nil {
+		return
 	}
-	fns[index] = f
-	m.Unlock()
+	for {
+		if _, ok := fns[index]; !ok {
+			break
+		}
+		index++
+	}
+	fns[index] = dispatchFunc{w, f}
+	// Queued under the lock, Exit() either sees the entry or runs first
 	C.CgoWebUiDispatch(w.w, C.uintptr_t(index))
 }
 
 func (w *webui) SetTitle(title string) {
-	p := C.CString(title)
+	p, n := borrowCString(title)
+	C.CgoWebUiSetTitle(w.w, p, n)
+}
+
+func (w *webui) Navigate(url string) {
+	p := C.CString(url)
 	defer C.free(unsafe.Pointer(p))
-	C.CgoWebUiSetTitle(w.w, p)
+	C.CgoWebUiNavigate(w.w, p)
+}
+
+func (w *webui) LoadHTML(html, baseURI string) {
+	p, n := borrowCString(html)
+	var base *C.char
+	if baseURI != "" {
+		base = C.CString(baseURI)
+		defer C.free(unsafe.Pointer(base))
+	}
+	C.CgoWebUiLoadHTML(w.w, p, n, base)
+}
+
+func (w *webui) Prerender(url string) {
+	p := C.CString(url)
+	defer C.free(unsafe.Pointer(p))
+	C.CgoWebUiPrerender(w.w, p)
 }
 
 func (w *webui) SetColor(r, g, b, a uint8) {
@@ -391,16 +1298,73 @@ func (w *webui) SetMinSize(width int, height int) {
 	C.CgoWebUiSetMinSize(w.w, C.int(width), C.int(height))
 }
 
+func (w *webui) Ready() {
+	C.CgoWebUiReady(w.w)
+}
+
+func (w *webui) Stats() Stats {
+	var s C.struct_webui_stats
+	C.CgoWebUiGetStats(w.w, &s)
+	stats := Stats{
+		Evals:         uint64(s.evals),
+		Invokes:       uint64(s.invokes),
+		Dispatches:    uint64(s.dispatches),
+		BytesToPage:   uint64(s.bytes_to_page),
+		BytesFromPage: uint64(s.bytes_from_page),
+		QueueDepth:    int(s.queue_depth),
+		EvalsInFlight: int(s.evals_in_flight),
+	}
+	for i := range stats.EvalLatency {
+		stats.EvalLatency[i] = uint64(s.eval_latency[i])
+		stats.InvokeLatency[i] = uint64(s.invoke_latency[i])
+		stats.DispatchLatency[i] = uint64(s.dispatch_latency[i])
+		stats.InputToPaint[i] = uint64(s.input_paint_latency[i])
+		stats.InputToHandler[i] = uint64(s.input_handler_latency[i])
+	}
+	stats.Inputs = uint64(s.inputs)
+	stats.VisibleTime = time.Duration(s.visible_time) * time.Microsecond
+	stats.HiddenTime = time.Duration(s.hidden_time) * time.Microsecond
+	stats.CPUVisible = time.Duration(s.cpu_visible) * time.Microsecond
+	stats.CPUHidden = time.Duration(s.cpu_hidden) * time.Microsecond
+	stats.DeferredEvals = uint64(s.deferred_evals)
+	stats.EvalTimeouts = uint64(s.eval_timeouts)
+	stats.EvalCancels = uint64(s.eval_cancels)
+	return stats
+}
+
+func (w *webui) StartupTimes() StartupTimes {
+	var s C.struct_webui_startup
+	C.CgoWebUiGetStartup(w.w, &s)
+	since := func(t C.int64_t) time.Duration {
+		if t == 0 {
+			return 0
+		}
+		return time.Duration(t-s.init) * time.Microsecond
+	}
+	return StartupTimes{
+		Committed: since(s.committed),
+		Finished:  since(s.finished),
+		Ready:     since(s.ready),
+		Shown:     since(s.shown),
+	}
+}
+
+func (w *webui) PurgeCaches() {
+	C.CgoWebUiPurgeCaches(w.w)
+}
+
+func (w *webui) ClearData(types DataType) {
+	C.CgoWebUiClearData(w.w, C.int(types))
+}
+
 func (w *webui) SetFullscreen(fullscreen bool) {
 	C.CgoWebUiSetFullscreen(w.w, C.int(boolToInt(fullscreen)))
 }
 
 func (w *webui) Message(title string, msg string, flags MessageFlag) MessageResponse {
-	titlePtr := C.CString(title)
-	defer C.free(unsafe.Pointer(titlePtr))
-	msgPtr := C.CString(msg)
-	defer C.free(unsafe.Pointer(msgPtr))
-	res := C.CgoWebUiMsg(w.w, C.int(flags), titlePtr, msgPtr)
+	titlePtr, titleLen := borrowCString(title)
+	msgPtr, msgLen := borrowCString(msg)
+	res := C.CgoWebUiMsg(w.w, C.int(flags), titlePtr, titleLen, msgPtr, msgLen)
 	return MessageResponse(res)
 }
 
@@ -428,33 +1392,211 @@ func (w *webui) file(Type int, filter string) string {
 }
 
 func (w *webui) Eval(js string) error {
-	p := C.CString(js)
-	defer C.free(unsafe.Pointer(p))
-	switch C.CgoWebUiEval(w.w, p) {
+	p, n := borrowCString(js)
+	return evalError(C.CgoWebUiEval(w.w, p, n))
+}
+
+func (w *webui) EvalAsync(js string) error {
+	p, n := borrowCString(js)
+	if C.CgoWebUiEvalAsync(w.w, p, n) != 0 {
+		return errors.New("page is not ready")
+	}
+	return nil
+}
+
+func evalError(r C.int) error {
+	switch r {
 	case -1:
 		return errors.New("evaluation failed")
+	case -2:
+		return ErrEvalTimeout
+	case -3:
+		return ErrEvalCancelled
 	}
 	return nil
 }
 
-func (w *webui) InjectCSS(css string) {
+func (w *webui) EvalContext(ctx context.Context, js string) error {
+	if err := ctx.Err(); err != nil {
+		if err == context.DeadlineExceeded {
+			return ErrEvalTimeout
+		}
+		return err
+	}
+	timeout := 0
+	if deadline, ok := ctx.Deadline(); ok {
+		// Round up, a zero timeout would wait forever
+		timeout = int((time.Until(deadline) + time.Millisecond - 1) / time.Millisecond)
+		if timeout <= 0 {
+			timeout = 1
+		}
+	}
+	// The deadline is left to the C timer, the goroutine handles cancel().
+	// cancel only reaches this call, not evals it runs nested in or under.
+	cancel := new(C.struct_webui_cancel)
+	stop := make(chan struct{})
+	stopped := make(chan struct{})
+	go func() {
+		defer close(stopped)
+		select {
+		case <-ctx.Done():
+			if ctx.Err() != context.DeadlineExceeded {
+				C.webui_eval_cancel(cancel)
+			}
+		case <-stop:
+		}
+	}()
+	p, n := borrowCString(js)
+	var res *C.char
+	r := C.CgoWebUiEvalTimeout(w.w, p, n, C.int(timeout), cancel, &res)
+	close(stop)
+	<-stopped
+	defer C.free(unsafe.Pointer(res))
+	switch r {
+	case 0:
+		return nil
+	case -2:
+		return ErrEvalTimeout
+	case -3:
+		if err := ctx.Err(); err != nil {
+			return err
+		}
+		return ErrEvalCancelled
+	}
+	return errors.New(C.GoString(res))
+}
+
+func (w *webui) NewBatch() *Batch {
+	return &Batch{w: w}
+}
+
+func (w *webui) EvalResult(js string) (string, error) {
+	p, n := borrowCString(js)
+	var res *C.char
+	r := C.CgoWebUiEvalResult(w.w, p, n, &res)
+	defer C.free(unsafe.Pointer(res))
+	if r == -2 || r == -3 {
+		return "", evalError(r)
+	} else if r != 0 {
+		return "", errors.New(C.GoString(res))
+	}
+	return C.GoString(res), nil
+}
+
+func (w *webui) WaitReady(timeout time.Duration) error {
+	if C.CgoWebUiWaitReady(w.w, C.int(timeout/time.Millisecond)) != 0 {
+		return errors.New("timeout waiting for the page to load")
+	}
+	return nil
+}
+
+func (w *webui) AddUserScript(js string) {
+	p := C.CString(js)
+	defer C.free(unsafe.Pointer(p))
+	C.CgoWebUiAddUserScript(w.w, p)
+}
+
+func (w *webui) AddStyle(css string) (int, error) {
 	p := C.CString(css)
 	defer C.free(unsafe.Pointer(p))
-	C.CgoWebUiInjectCSS(w.w, p)
+	id := int(C.CgoWebUiStyleAdd(w.w, p))
+	if id < 0 {
+		return 0, errors.New("failed to add style sheet")
+	}
+	return id, nil
+}
+
+func (w *webui) ReplaceStyle(id int, css string) error {
+	p, n := borrowCString(css)
+	if C.CgoWebUiStyleReplace(w.w, C.int(id), p, n) != 0 {
+		return fmt.Errorf("unknown style sheet %d", id)
+	}
+	return nil
+}
+
+func (w *webui) RemoveStyle(id int) error {
+	if C.CgoWebUiStyleRemove(w.w, C.int(id)) != 0 {
+		return fmt.Errorf("unknown style sheet %d", id)
+	}
+	return nil
+}
+
+func (w *webui) UseLibrary(name string) error {
+	p := C.CString(name)
+	defer C.free(unsafe.Pointer(p))
+	if C.CgoWebUiUseLibrary(w.w, p) != 0 {
+		return errors.New("unknown library " + name)
+	}
+	return nil
+}
+
+func (w *webui) InjectCSS(css string) {
+	p, n := borrowCString(css)
+	C.CgoWebUiInjectCSS(w.w, p, n)
 }
 
 func (w *webui) Terminate() {
 	C.CgoWebUiTerminate(w.w)
 }
 
+func (w *webui) OnFrame(f FrameCallbackFunc) {
+	m.Lock()
+	if f != nil {
+		cbf[w] = f
+	} else {
+		delete(cbf, w)
+	}
+	m.Unlock()
+	C.CgoWebUiOnFrame(w.w, C.int(boolToInt(f != nil)))
+}
+
+func (w *webui) Snapshot(format SnapshotFormat, fullDocument bool) ([]byte, int, int, error) {
+	var (
+		data          *C.uint8_t
+		size          C.size_t
+		width, height C.int
+	)
+	if C.CgoWebUiSnapshot(w.w, C.int(format), C.int(boolToInt(fullDocument)),
+		&data, &size, &width, &height) != 0 {
+		return nil, 0, 0, errors.New("snapshot failed")
+	}
+	defer C.free(unsafe.Pointer(data))
+	return C.GoBytes(unsafe.Pointer(data), C.int(size)), int(width), int(height), nil
+}
+
+func (w *webui) CollectTrace() error {
+	if C.CgoWebUiTraceCollectPage(w.w) != 0 {
+		return errors.New("failed to collect page trace")
+	}
+	return nil
+}
+
+func (w *webui) NewSurface(canvasID string, width, height int) (*Surface, error) {
+	p := C.CString(canvasID)
+	defer C.free(unsafe.Pointer(p))
+	s := C.CgoWebUiSurfaceNew(w.w, p, C.int(width), C.int(height))
+	if s == nil {
+		return nil, errors.New("failed to create surface")
+	}
+	surface := &Surface{s: (*C.struct_webui_surface)(s), w: w, width: width, height: height}
+	m.Lock()
+	if w.surfaces == nil {
+		w.surfaces = map[*Surface]struct{}{}
+	}
+	w.surfaces[surface] = struct{}{}
+	m.Unlock()
+	return surface, nil
+}
+
 //export _WebUiDispatchGoCallback
 func _WebUiDispatchGoCallback(index unsafe.Pointer) {
-	var f func()
 	m.Lock()
-	f = fns[uintptr(index)]
+	d, ok := fns[uintptr(index)]
 	delete(fns, uintptr(index))
 	m.Unlock()
-	f()
+	if ok {
+		d.f()
+	}
 }
 
 //export _WebUiCloseCallback
@@ -476,6 +1618,138 @@ func _WebUiCloseCallback(w unsafe.Pointer) C.int {
 	return C.int(0)
 }
 
+//export _WebUiFrameCallback
+func _WebUiFrameCallback(w unsafe.Pointer, frameTime C.int64_t, frame C.int64_t) {
+	m.Lock()
+	var (
+		cb FrameCallbackFunc
+		wv WebUI
+	)
+	for k, f := range cbf {
+		if k.(*webui).w == w {
+			wv, cb = k, f
+			break
+		}
+	}
+	m.Unlock()
+	if cb != nil {
+		cb(wv, time.Duration(frameTime)*time.Microsecond, int64(frame))
+	}
+}
+
+//export _WebUiLoadCallback
+func _WebUiLoadCallback(w unsafe.Pointer, event C.int, ts C.int64_t, uri *C.char, data *C.char) {
+	m.Lock()
+	var (
+		cb LoadCallbackFunc
+		wv WebUI
+	)
+	for k, f := range cbl {
+		if k.(*webui).w == w {
+			wv, cb = k, f
+			break
+		}
+	}
+	m.Unlock()
+	if cb == nil {
+		return
+	}
+	var s C.struct_webui_startup
+	C.CgoWebUiGetStartup(w, &s)
+	e := LoadEvent{
+		Type: LoadEventType(event),
+		Time: time.Duration(ts-s.init) * time.Microsecond,
+	}
+	if uri != nil {
+		e.URI = C.GoString(uri)
+	}
+	switch e.Type {
+	case LoadFailed:
+		e.Error = C.GoString(data)
+	case LoadTiming:
+		e.Timing = json.RawMessage(C.GoString(data))
+	}
+	cb(wv, e)
+}
+
+//export _WebUiVisibilityCallback
+func _WebUiVisibilityCallback(w unsafe.Pointer, visible C.int, focused C.int) {
+	m.Lock()
+	var (
+		cb      VisibilityCallbackFunc
+		wv      *webui
+		pending map[string]func()
+	)
+	for k := range cbei {
+		if k.(*webui).w == w {
+			wv, cb = k.(*webui), cbv[k]
+			break
+		}
+	}
+	if wv != nil {
+		wv.hidden = wv.throttle && visible == 0
+		if !wv.hidden {
+			pending, wv.pending = wv.pending, nil
+		}
+	}
+	m.Unlock()
+	if len(pending) > 0 {
+		// the syncs wait for their Eval(), which must not nest the main
+		// loop inside the GTK signal handler this is called from
+		wv.Dispatch(func() {
+			for _, sync := range pending {
+				sync()
+			}
+		})
+	}
+	if cb != nil {
+		cb(wv, visible != 0, focused != 0)
+	}
+}
+
+// deferSync keeps the latest sync of a binding while the window is hidden,
+// it runs once the window is visible again
+func (w *webui) deferSync(name string, sync func()) bool {
+	m.Lock()
+	defer m.Unlock()
+	if !w.hidden {
+		return false
+	}
+	if w.pending == nil {
+		w.pending = map[string]func(){}
+	}
+	w.pending[name] = sync
+	return true
+}
+
+//export _WebUiRecoverCallback
+func _WebUiRecoverCallback(w unsafe.Pointer, reason C.int) {
+	m.Lock()
+	var (
+		cb    RecoverCallbackFunc
+		wv    *webui
+		syncs []func()
+	)
+	for k := range cbei {
+		if k.(*webui).w == w {
+			wv, cb = k.(*webui), cbr[k]
+			syncs = wv.syncs
+			break
+		}
+	}
+	m.Unlock()
+	if wv == nil {
+		return
+	}
+	// The binding stubs are user scripts and already in the new page
+	for _, sync := range syncs {
+		sync()
+	}
+	if cb != nil {
+		cb(wv, RecoverReason(reason))
+	}
+}
+
 //export _WebUiExternalInvokeCallback
 func _WebUiExternalInvokeCallback(w unsafe.Pointer, data unsafe.Pointer) {
 	m.Lock()
@@ -639,6 +1913,9 @@ func (w *webui) Bind(name string, v interface{}) (sync func(), err error) {
 		return nil, err
 	}
 	sync = func() {
+		if w.deferSync(name, sync) {
+			return
+		}
 		if js, err := b.Sync(); err != nil {
 			log.Println(err)
 		} else {
@@ -655,9 +1932,10 @@ func (w *webui) Bind(name string, v interface{}) (sync func(), err error) {
 			cb(w, data)
 		}
 	}
+	w.syncs = append(w.syncs, sync)
 	m.Unlock()
 
-	w.Eval(js)
+	w.AddUserScript(js)
 	sync()
 	return sync, nil
 }
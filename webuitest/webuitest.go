@@ -0,0 +1,212 @@
+// Package webuitest drives webui pages from Go tests without a browser
+// automation stack.
+//
+// Every page is an offscreen window, so tests run headless (under Xvfb or
+// Broadway in CI) and many packages can be tested in parallel processes.
+// GTK must be driven from the main thread, so the test binary hands it over
+// to Main:
+//
+//	func TestMain(m *testing.M) {
+//		webuitest.Main(m)
+//	}
+//
+//	func TestCounter(t *testing.T) {
+//		d := webuitest.New(t, webui.Settings{URL: url})
+//		d.Click("#add")
+//		if v, _ := d.Eval(`counter.data.value`); v != "1" {
+//			t.Fatal("counter not incremented")
+//		}
+//	}
+package webuitest
+
+import (
+	"encoding/json"
+	"errors"
+	"fmt"
+	"os"
+	"testing"
+	"time"
+
+	"github.com/srfirouzi/webui"
+)
+
+// DefaultTimeout is used by the waiting methods when no timeout is given
+var DefaultTimeout = 10 * time.Second
+
+var calls = make(chan func(), 16)
+
+// Main runs the tests and serves the UI loop on the main thread until they
+// finish, then exits with their result.
+//
+// Driver calls are handed to the main thread one at a time and wait there
+// in nested loops that do not run other queued driver calls, so all pages
+// of a test binary are driven one call after the other: parallel tests do
+// not speed up, and a page is best tested with one window at a time.
+func Main(m *testing.M) {
+	done := make(chan int, 1)
+	go func() {
+		done <- m.Run()
+		webui.Wakeup()
+	}()
+	for {
+		select {
+		case code := <-done:
+			os.Exit(code)
+		case f := <-calls:
+			f()
+		default:
+			webui.Iterate(true)
+		}
+	}
+}
+
+// run executes f on the main thread and waits for it.
+func run(f func()) {
+	ran := make(chan struct{})
+	calls <- func() {
+		defer close(ran)
+		f()
+	}
+	webui.Wakeup()
+	<-ran
+}
+
+// Driver controls a single offscreen page.
+type Driver struct {
+	t testing.TB
+	w webui.WebUI
+}
+
+// New opens an offscreen page with the given settings and closes it when
+// the test finishes.
+func New(t testing.TB, settings webui.Settings) *Driver {
+	t.Helper()
+	settings.Offscreen = true
+	d := &Driver{t: t}
+	run(func() { d.w = webui.New(settings) })
+	t.Cleanup(d.Close)
+	if err := d.WaitLoad(DefaultTimeout); err != nil {
+		t.Fatal(err)
+	}
+	return d
+}
+
+// WebUI returns the underlying window. Its methods must only be called
+// through Do().
+func (d *Driver) WebUI() webui.WebUI {
+	return d.w
+}
+
+// Do runs f on the main thread.
+func (d *Driver) Do(f func(w webui.WebUI)) {
+	run(func() { f(d.w) })
+}
+
+// WaitLoad waits until the page has finished loading.
+func (d *Driver) WaitLoad(timeout time.Duration) (err error) {
+	run(func() { err = d.w.WaitReady(timeout) })
+	return err
+}
+
+// Eval evaluates JS code and returns the value of its last expression as
+// JSON.
+func (d *Driver) Eval(js string) (res string, err error) {
+	run(func() { res, err = d.w.EvalResult(js) })
+	return res, err
+}
+
+// EvalInto evaluates JS code and decodes its JSON result into v.
+func (d *Driver) EvalInto(js string, v interface{}) error {
+	res, err := d.Eval(js)
+	if err != nil {
+		return err
+	}
+	return json.Unmarshal([]byte(res), v)
+}
+
+// WaitSelector waits until an element matches the CSS selector.
+func (d *Driver) WaitSelector(selector string, timeout time.Duration) error {
+	if timeout == 0 {
+		timeout = DefaultTimeout
+	}
+	js := fmt.Sprintf(`document.querySelector(%s)!==null`, quote(selector))
+	deadline := time.Now().Add(timeout)
+	for {
+		if res, err := d.Eval(js); err != nil {
+			return err
+		} else if res == "true" {
+			return nil
+		}
+		if time.Now().After(deadline) {
+			return fmt.Errorf("timeout waiting for %q", selector)
+		}
+		time.Sleep(10 * time.Millisecond)
+	}
+}
+
+// Click sends mouse events and a click to the element matching selector.
+func (d *Driver) Click(selector string) error {
+	return d.input(selector, `e.scrollIntoView();
+		['mousedown','mouseup'].forEach(function(t){
+			e.dispatchEvent(new MouseEvent(t,{bubbles:true,cancelable:true,view:window}));
+		});
+		e.click();`, "")
+}
+
+// Type focuses the element matching selector and types text into it, one
+// key at a time.
+func (d *Driver) Type(selector, text string) error {
+	return d.input(selector, `e.focus();
+		for (var i = 0; i < arg.length; i++) {
+			var k = arg[i];
+			e.dispatchEvent(new KeyboardEvent('keydown',{key:k,bubbles:true}));
+			e.value += k;
+			e.dispatchEvent(new InputEvent('input',{data:k,inputType:'insertText',bubbles:true}));
+			e.dispatchEvent(new KeyboardEvent('keyup',{key:k,bubbles:true}));
+		}
+		e.dispatchEvent(new Event('change',{bubbles:true}));`, text)
+}
+
+// Key sends a keydown/keyup pair, e.g. "Enter" or "Escape", to the element
+// matching selector.
+func (d *Driver) Key(selector, key string) error {
+	return d.input(selector, `['keydown','keyup'].forEach(function(t){
+			e.dispatchEvent(new KeyboardEvent(t,{key:arg,bubbles:true,cancelable:true}));
+		});`, key)
+}
+
+func (d *Driver) input(selector, body, arg string) error {
+	js := fmt.Sprintf(`(function(e,arg){if(!e){return false;}%s;return true;})(document.querySelector(%s),%s)`,
+		body, quote(selector), quote(arg))
+	res, err := d.Eval(js)
+	if err != nil {
+		return err
+	}
+	if res != "true" {
+		return fmt.Errorf("no element matches %q", selector)
+	}
+	return nil
+}
+
+// Snapshot returns a PNG image of the whole page.
+func (d *Driver) Snapshot() (png []byte, err error) {
+	run(func() { png, _, _, err = d.w.Snapshot(webui.SnapshotPNG, true) })
+	return png, err
+}
+
+// Close closes the page, it is called automatically when the test ends.
+func (d *Driver) Close() {
+	if d.w == nil {
+		return
+	}
+	run(func() { d.w.Exit() })
+	d.w = nil
+}
+
+func quote(s string) string {
+	b, err := json.Marshal(s)
+	if err != nil {
+		panic(errors.New("webuitest: " + err.Error()))
+	}
+	return string(b)
+}
@@ -0,0 +1,49 @@
+package webuitest_test
+
+import (
+	"net/url"
+	"testing"
+
+	"github.com/srfirouzi/webui"
+	"github.com/srfirouzi/webui/webuitest"
+)
+
+func TestMain(m *testing.M) {
+	webuitest.Main(m)
+}
+
+const page = `<!doctype html>
+<html><body>
+<button id="add" onclick="count++;document.getElementById('out').textContent=count">add</button>
+<span id="out">0</span>
+<script>var count = 0;</script>
+</body></html>`
+
+func TestDriver(t *testing.T) {
+	d := webuitest.New(t, webui.Settings{
+		URL: "data:text/html," + url.PathEscape(page),
+	})
+	if err := d.WaitLoad(webuitest.DefaultTimeout); err != nil {
+		t.Fatal(err)
+	}
+	if v, err := d.Eval(`1 + 2`); err != nil || v != "3" {
+		t.Fatalf("Eval() = %q, %v, want 3", v, err)
+	}
+	if err := d.Click("#add"); err != nil {
+		t.Fatal(err)
+	}
+	var state struct {
+		Count int
+		Text  string
+	}
+	err := d.EvalInto(`({Count: count, Text: document.getElementById('out').textContent})`, &state)
+	if err != nil {
+		t.Fatal(err)
+	}
+	if state.Count != 1 || state.Text != "1" {
+		t.Fatalf("after Click() got %+v, want count 1", state)
+	}
+	if err := d.Click("#missing"); err == nil {
+		t.Fatal("Click() on a missing element succeeded")
+	}
+}